@@ -0,0 +1,380 @@
+#include "arena.hpp"
+#include "expr.hpp"
+#include "flat.hpp"
+#include "interp.hpp"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// lambda_bench [--filter text] [--min-time ms]
+//
+// Runs every workload in the corpus and times its phases separately: parse
+// (interpret_expression), reduce (reduce_expression), print (Expr::to_string)
+// and print_flat (the result printed from a FlatPool, see flat.hpp), plus the
+// two ways of loading a large prelude. Each phase
+// prints one JSON object per line:
+//
+//   workload, phase      what was measured
+//   iterations           timed runs, after one untimed warm-up run
+//   mean_ns, min_ns      wall time per run
+//   allocs, alloc_bytes  per run: operator new calls and their bytes, plus
+//                        nodes taken from malloc by node_alloc
+//   arena_allocs         per run: nodes and blocks served by arenas
+//   heap_bytes           bytes malloc holds once the phase ends
+//   max_rss_kb           peak resident size of the process so far
+
+//every allocation in the process goes through these, so the counts include
+//the interpreter's own containers and strings
+static std::atomic<uint64_t> _new_calls = 0;
+static std::atomic<uint64_t> _new_bytes = 0;
+
+void* operator new(size_t size) {
+    _new_calls.fetch_add(1, std::memory_order_relaxed);
+    _new_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+struct _Counters {
+    uint64_t new_calls;
+    uint64_t new_bytes;
+    AllocStats nodes;
+};
+
+static _Counters _sample() {
+    return { _new_calls.load(), _new_bytes.load(), get_alloc_stats() };
+}
+
+struct _Measurement {
+    uint64_t iterations = 0;
+    double mean_ns = 0;
+    double min_ns = 0;
+    double allocs = 0;
+    double alloc_bytes = 0;
+    double arena_allocs = 0;
+};
+
+// Runs `body` once to warm caches and definitions up, then repeatedly until
+// `min_ns` has passed and at least three runs were timed.
+static _Measurement _measure(const std::function<void()>& body, double min_ns) {
+    using clock = std::chrono::steady_clock;
+    body();
+
+    _Measurement m;
+    m.min_ns = 1e300;
+    double total = 0;
+    _Counters before = _sample();
+    while (m.iterations < 3 || total < min_ns) {
+        clock::time_point start = clock::now();
+        body();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        total += ns;
+        if (ns < m.min_ns) m.min_ns = ns;
+        m.iterations++;
+    }
+    _Counters after = _sample();
+
+    double n = (double)m.iterations;
+    m.mean_ns = total / n;
+    m.allocs = (double)(after.new_calls - before.new_calls + after.nodes.heap_allocs - before.nodes.heap_allocs) / n;
+    m.alloc_bytes = (double)(after.new_bytes - before.new_bytes) / n;
+    m.arena_allocs = (double)(after.nodes.arena_allocs - before.nodes.arena_allocs) / n;
+    return m;
+}
+
+static void _report(const char* workload, const char* phase, const _Measurement& m) {
+    struct mallinfo2 heap = mallinfo2();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"workload\":\"%s\",\"phase\":\"%s\",\"iterations\":%llu,\"mean_ns\":%.0f,\"min_ns\":%.0f,"
+        "\"allocs\":%.1f,\"alloc_bytes\":%.0f,\"arena_allocs\":%.1f,\"heap_bytes\":%zu,\"max_rss_kb\":%ld}\n",
+        workload, phase, (unsigned long long)m.iterations, m.mean_ns, m.min_ns,
+        m.allocs, m.alloc_bytes, m.arena_allocs, heap.uordblks + heap.hblkhd, usage.ru_maxrss);
+    fflush(stdout);
+}
+
+//definitions every expression workload starts from
+static const char* _PRELUDE[][2] = {
+    { "ZERO", "\\f.\\x.x" },
+    { "SUCC", "\\n.\\f.\\x.f (n f x)" },
+    { "ADD", "\\m.\\n.\\f.\\x.m f (n f x)" },
+    { "MUL", "\\m.\\n.\\f.m (n f)" },
+    { "EXP", "\\m.\\n.n m" },
+    { "PRED", "\\n.\\f.\\x.n (\\g.\\h.h (g f)) (\\u.x) (\\u.u)" },
+    { "TRUE", "\\a.\\b.a" },
+    { "FALSE", "\\a.\\b.b" },
+    { "ISZERO", "\\n.n (\\x.FALSE) TRUE" },
+    { "PAIR", "\\a.\\b.\\s.s a b" },
+    { "FST", "\\p.p TRUE" },
+    { "SND", "\\p.p FALSE" },
+    { "ONE", "SUCC ZERO" },
+    { "TWO", "SUCC ONE" },
+    { "THREE", "SUCC TWO" },
+    { "FIVE", "ADD TWO THREE" },
+    { "SIX", "MUL TWO THREE" },
+    { "SEVEN", "SUCC SIX" },
+    { "TEN", "MUL TWO FIVE" },
+    { "HUNDRED", "MUL TEN TEN" },
+    //primitive recursion over pairs (i, i!)
+    { "FACT", "\\n.SND (n (\\p.PAIR (SUCC (FST p)) (MUL (SUCC (FST p)) (SND p))) (PAIR ZERO ONE))" },
+    { "Y", "\\f.(\\x.f (x x)) (\\x.f (x x))" },
+    { "YFACT", "Y (\\r.\\n.ISZERO n ONE (MUL n (r (PRED n))))" },
+};
+
+struct _Workload {
+    const char* name;
+    std::string expr;
+    ReduceOptions options;
+};
+
+// \x.(\y.y) ((\y.y) (... x)): redexes nested `depth` deep
+static std::string _deep(size_t depth) {
+    std::string s = "\\x.";
+    for (size_t i = 0; i < depth; i++) s += "(\\y.y) (";
+    s += "x";
+    s.append(depth, ')');
+    return s;
+}
+
+// (\a.\f.f a a ... a) (\z.z): one substitution into `width` arguments
+static std::string _wide(size_t width) {
+    std::string s = "(\\a.\\f.f";
+    for (size_t i = 0; i < width; i++) s += " a";
+    s += ") (\\z.z)";
+    return s;
+}
+
+// \c.\n.c e (c e (... n)): a Church list of `length` copies of `element`,
+// whose normal forms are only reached by the read-back
+static std::string _list(size_t length, const char* element) {
+    std::string s = "\\c.\\n.";
+    for (size_t i = 0; i < length; i++) s += std::string("c (") + element + ") (";
+    s += "n";
+    s.append(length, ')');
+    return s;
+}
+
+//deterministic, so every run builds the same corpus
+struct _Random {
+    uint64_t state;
+    uint32_t next(uint32_t bound) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (uint32_t)(state >> 33) % bound;
+    }
+};
+
+// A closed term of about `size` nodes that is already normal, so parsing and
+// printing it dominate
+static std::string _big(size_t size, _Random& random) {
+    std::string s = "\\a.\\b.\\c.";
+    std::function<void(size_t, uint32_t)> build = [&](size_t nodes, uint32_t depth) {
+        if (nodes <= 1 || depth > 40) {
+            s += "abc"[random.next(3)];
+            return;
+        }
+        size_t lhs = 1 + random.next((uint32_t)(nodes - 1));
+        s += "(";
+        build(lhs, depth + 1);
+        s += " ";
+        build(nodes - lhs, depth + 1);
+        s += ")";
+    };
+    build(size, 0);
+    return s;
+}
+
+// `count` definitions of random combinators, each using earlier ones
+static std::vector<std::pair<std::string, std::string>> _prelude_corpus(size_t count, _Random& random) {
+    std::vector<std::pair<std::string, std::string>> defs;
+    std::function<std::string(uint32_t, uint32_t)> gen = [&](uint32_t depth, uint32_t bound) -> std::string {
+        uint32_t r = random.next(100);
+        if (depth > 6 || r < 30) {
+            if (bound > 0 && random.next(10) < 7) return "v" + std::to_string(random.next(bound));
+            if (!defs.empty() && random.next(2)) return defs[random.next((uint32_t)defs.size())].first;
+            return "v0";
+        }
+        if (r < 55) return "\\v" + std::to_string(bound) + "." + gen(depth + 1, bound + 1);
+        return "(" + gen(depth + 1, bound) + " " + gen(depth + 1, bound) + ")";
+    };
+    for (size_t i = 0; i < count; i++) {
+        std::string body = "\\v0." + gen(0, 1);
+        defs.push_back({ "C" + std::to_string(i), body });
+    }
+    return defs;
+}
+
+static void _run_workload(const _Workload& w, double min_ns) {
+    Session session;
+    for (auto& def : _PRELUDE) session.set_variable(def[0], def[1]);
+
+    _Measurement parse = _measure([&] {
+        Arena arena;
+        ArenaScope scope(&arena);
+        auto instr = session.interpret_expression(w.expr);
+        //the nodes belong to the arena, which frees them all at once
+        if (instr) instr->expr.release();
+    }, min_ns);
+    _report(w.name, "parse", parse);
+
+    Arena input;
+    ArenaScope input_scope(&input);
+    auto instr = session.interpret_expression(w.expr);
+    if (!instr) {
+        fprintf(stderr, "%s: %s\n", w.name, session.get_error_text().c_str());
+        return;
+    }
+    Expr* expr = instr->expr.release();
+
+    bool failed = false;
+    _Measurement reduce = _measure([&] {
+        Arena arena;
+        ArenaScope scope(&arena);
+        failed = failed || !session.reduce_expression(expr, w.options);
+    }, min_ns);
+    if (failed) {
+        fprintf(stderr, "%s: %s\n", w.name, session.get_error_text().c_str());
+        return;
+    }
+    _report(w.name, "reduce", reduce);
+
+    Expr* result = session.reduce_expression(expr, w.options);
+    std::string text;
+    _Measurement print = _measure([&] { text = result->to_string(); }, min_ns);
+    _report(w.name, "print", print);
+
+    FlatPool pool;
+    FlatNode flat = flat_from_expr(pool, *result);
+    _Measurement print_flat = _measure([&] {
+        text.clear();
+        flat_print(pool, flat, text);
+    }, min_ns);
+    _report(w.name, "print_flat", print_flat);
+}
+
+static void _run_prelude(const char* name, size_t count, double min_ns) {
+    _Random random = { 7 };
+    auto defs = _prelude_corpus(count, random);
+
+    _Measurement text = _measure([&] {
+        Session session;
+        for (auto& def : defs) session.set_variable(def.first.c_str(), def.second.c_str());
+    }, min_ns);
+    _report(name, "load_text", text);
+
+    char path[] = "/tmp/lambda_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+    close(fd);
+    {
+        Session session;
+        for (auto& def : defs) session.set_variable(def.first.c_str(), def.second.c_str());
+        session.save_snapshot(path);
+    }
+    _Measurement snapshot = _measure([&] {
+        Session session;
+        session.load_snapshot(path);
+    }, min_ns);
+    _report(name, "load_snapshot", snapshot);
+    unlink(path);
+}
+
+int main(int argc, char** argv) {
+    const char* filter = nullptr;
+    double min_ns = 200e6;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_ns = atof(argv[++i]) * 1e6;
+        } else {
+            fprintf(stderr, "usage: lambda_bench [--filter text] [--min-time ms]\n");
+            return 1;
+        }
+    }
+
+    ReduceOptions strict;
+    ReduceOptions lazy;
+    lazy.lazy = true;
+    ReduceOptions machine;
+    machine.backend = Backend::Machine;
+    ReduceOptions native;
+    native.native = true;
+    ReduceOptions net;
+    net.backend = Backend::Net;
+    ReduceOptions vm;
+    vm.backend = Backend::Vm;
+    ReduceOptions lazy_vm = vm;
+    lazy_vm.lazy = true;
+    ReduceOptions hnf;
+    hnf.strategy = Strategy::Hnf;
+    ReduceOptions parallel_1;
+    parallel_1.backend = Backend::Parallel;
+    parallel_1.threads = 1;
+    ReduceOptions parallel_n = parallel_1;
+    parallel_n.threads = 0;
+
+    _Random random = { 42 };
+    std::vector<_Workload> workloads = {
+        { "church_add", "ADD (EXP TWO TEN) (EXP TWO TEN)", strict },
+        { "church_mul", "MUL HUNDRED HUNDRED", strict },
+        { "church_exp", "EXP TWO (ADD TEN THREE)", strict },
+        { "church_factorial", "FACT SEVEN", strict },
+        { "church_mul_native", "MUL HUNDRED HUNDRED", native },
+        { "church_mul_vm", "MUL HUNDRED HUNDRED", vm },
+        { "church_factorial_native", "FACT SEVEN", native },
+        { "church_factorial_net", "FACT SEVEN", net },
+        { "church_factorial_vm", "FACT SEVEN", vm },
+        { "church_tower", "TWO TWO TWO TWO (\\x.x)", strict },
+        { "church_tower_net", "TWO TWO TWO TWO (\\x.x)", net },
+        { "church_tower_vm", "TWO TWO TWO TWO (\\x.x)", vm },
+        { "y_recursion", "YFACT SIX", lazy },
+        { "y_recursion_vm", "YFACT SIX", lazy_vm },
+        { "is_zero", "ISZERO (FACT SEVEN)", strict },
+        { "is_zero_hnf", "ISZERO (FACT SEVEN)", hnf },
+        { "deep_nesting", _deep(20000), machine },
+        { "wide_application", _wide(20000), machine },
+        { "big_term", _big(200000, random), strict },
+        //the same read-back on one thread and on one per hardware thread
+        { "church_list_parallel_1", _list(64, "MUL HUNDRED TEN"), parallel_1 },
+        { "church_list_parallel_n", _list(64, "MUL HUNDRED TEN"), parallel_n },
+    };
+
+    for (const _Workload& w : workloads) {
+        if (filter && !strstr(w.name, filter)) continue;
+        _run_workload(w, min_ns);
+    }
+    if (!filter || strstr("prelude_load", filter)) _run_prelude("prelude_load", 5000, min_ns);
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "arena.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+struct Arena::_Chunk {
+    _Chunk* next;
+    size_t size;
+};
+
+static thread_local Arena* _current_arena = nullptr;
+static thread_local AllocStats _stats = {};
+
+static constexpr size_t _ALIGN = alignof(std::max_align_t);
+
+static size_t _align_up(size_t size) {
+    return (size + _ALIGN - 1) & ~(_ALIGN - 1);
+}
+
+AllocStats get_alloc_stats() {
+    return _stats;
+}
+
+void reset_alloc_stats() {
+    _stats = {};
+}
+
+Arena::Arena() {
+    _chunks = nullptr;
+    _cursor = nullptr;
+    _end = nullptr;
+    _next_chunk = _FIRST_CHUNK;
+    _reserved = 0;
+    _used = 0;
+    memset(_free, 0, sizeof(_free));
+}
+
+Arena::~Arena() {
+    reset();
+}
+
+void Arena::_new_chunk(size_t min_size) {
+    size_t size = _next_chunk;
+    while (size < min_size + _align_up(sizeof(_Chunk))) size *= 2;
+    if (_next_chunk < _MAX_CHUNK) _next_chunk *= 2;
+
+    _Chunk* chunk = (_Chunk*)malloc(size);
+    if (!chunk) throw std::bad_alloc();
+    chunk->next = _chunks;
+    chunk->size = size;
+    _chunks = chunk;
+    _cursor = (char*)chunk + _align_up(sizeof(_Chunk));
+    _end = (char*)chunk + size;
+    _reserved += size;
+    _stats.arena_bytes += size;
+}
+
+void* Arena::alloc(size_t size) {
+    size = _align_up(size);
+    if ((size_t)(_end - _cursor) < size) _new_chunk(size);
+    void* ptr = _cursor;
+    _cursor += size;
+    _used += size;
+    _stats.arena_allocs++;
+    return ptr;
+}
+
+void* Arena::alloc_node(size_t size) {
+    size_t cls = _align_up(size) / _ALIGN;
+    if (cls < _SIZE_CLASSES && _free[cls]) {
+        _FreeNode* node = _free[cls];
+        _free[cls] = node->next;
+        _stats.arena_reuses++;
+        return node;
+    }
+    return alloc(size);
+}
+
+void Arena::free_node(void* ptr, size_t size) {
+    size_t cls = _align_up(size) / _ALIGN;
+    if (cls >= _SIZE_CLASSES) return;
+    _FreeNode* node = (_FreeNode*)ptr;
+    node->next = _free[cls];
+    _free[cls] = node;
+}
+
+const char* Arena::copy_string(std::string_view sv) {
+    char* ptr = (char*)alloc(sv.size() + 1);
+    memcpy(ptr, sv.data(), sv.size());
+    ptr[sv.size()] = '\0';
+    return ptr;
+}
+
+bool Arena::owns(const void* ptr) const {
+    for (_Chunk* chunk = _chunks; chunk; chunk = chunk->next) {
+        if (ptr >= (const void*)chunk && ptr < (const void*)((char*)chunk + chunk->size)) return true;
+    }
+    return false;
+}
+
+void Arena::reset() {
+    _Chunk* chunk = _chunks;
+    while (chunk) {
+        _Chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    _chunks = nullptr;
+    _cursor = nullptr;
+    _end = nullptr;
+    _next_chunk = _FIRST_CHUNK;
+    _reserved = 0;
+    _used = 0;
+    memset(_free, 0, sizeof(_free));
+}
+
+void Arena::adopt(Arena& other) {
+    if (!other._chunks) return;
+    if (!_chunks) {
+        _chunks = other._chunks;
+        _cursor = other._cursor;
+        _end = other._end;
+    } else {
+        //keep bumping from our own head chunk, the adopted ones are only owned
+        _Chunk* tail = other._chunks;
+        while (tail->next) tail = tail->next;
+        tail->next = _chunks->next;
+        _chunks->next = other._chunks;
+    }
+    _reserved += other._reserved;
+    _used += other._used;
+
+    other._chunks = nullptr;
+    other.reset();
+}
+
+size_t Arena::bytes_reserved() const {
+    return _reserved;
+}
+
+size_t Arena::bytes_used() const {
+    return _used;
+}
+
+Arena* Arena::current() {
+    return _current_arena;
+}
+
+ArenaScope::ArenaScope(Arena* arena) {
+    _prev = _current_arena;
+    _current_arena = arena;
+}
+
+ArenaScope::~ArenaScope() {
+    _current_arena = _prev;
+}
+
+void* node_alloc(size_t size) {
+    if (_current_arena) return _current_arena->alloc_node(size);
+    _stats.heap_allocs++;
+    void* ptr = malloc(size);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void node_free(void* ptr, size_t size, bool in_arena) {
+    if (!in_arena) {
+        _stats.heap_frees++;
+        free(ptr);
+        return;
+    }
+    //nodes of an arena that is not active here are left for the arena to drop
+    if (_current_arena && _current_arena->owns(ptr)) _current_arena->free_node(ptr, size);
+}
\ No newline at end of file
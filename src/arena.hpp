@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+struct AllocStats {
+    size_t heap_allocs;     //nodes that went through malloc/new
+    size_t heap_frees;
+    size_t arena_allocs;    //bump allocations served by an arena
+    size_t arena_reuses;    //allocations served by an arena free-list
+    size_t arena_bytes;     //bytes reserved by arenas for their chunks
+};
+
+AllocStats get_alloc_stats();
+void reset_alloc_stats();
+
+// Bump allocator with per-size free-lists. Everything allocated from an arena
+// is released at once when the arena is reset or destroyed, so values built
+// inside one must not be deleted after the arena goes away.
+struct Arena {
+    Arena();
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* alloc(size_t size);
+    void* alloc_node(size_t size); //like alloc, but may recycle a freed node
+    void free_node(void* ptr, size_t size);
+    const char* copy_string(std::string_view sv);
+    bool owns(const void* ptr) const;
+    void reset();
+    // Takes over the chunks of `other`, which is left empty. Whatever either
+    // arena handed out stays valid until this one is reset.
+    void adopt(Arena& other);
+
+    size_t bytes_reserved() const;
+    size_t bytes_used() const;
+
+    static Arena* current();
+
+private:
+    struct _Chunk;
+    struct _FreeNode { _FreeNode* next; };
+
+    static constexpr size_t _SIZE_CLASSES = 32;
+    static constexpr size_t _FIRST_CHUNK = 64 * 1024;
+    static constexpr size_t _MAX_CHUNK = 4 * 1024 * 1024;
+
+    void _new_chunk(size_t min_size);
+
+    _Chunk* _chunks;
+    char* _cursor;
+    char* _end;
+    size_t _next_chunk;
+    size_t _reserved;
+    size_t _used;
+    _FreeNode* _free[_SIZE_CLASSES];
+
+    friend struct ArenaScope;
+};
+
+// Makes an arena the allocation target for term nodes on this
+// thread until the scope ends. Passing nullptr suspends any active arena, which
+// is how values that must outlive it are promoted to the heap.
+struct ArenaScope {
+    explicit ArenaScope(Arena* arena);
+    ~ArenaScope();
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena* _prev;
+};
+
+// Allocation helpers used by Expr and Term nodes: they target the current arena
+// if there is one and the heap otherwise, and keep the counters up to date.
+void* node_alloc(size_t size);
+void node_free(void* ptr, size_t size, bool in_arena);
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "batch.hpp"
+#include "arena.hpp"
+#include "command.hpp"
+#include "interp.hpp"
+#include "printer.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct _Line {
+    std::string text; //what the line prints, queries get their result appended by a task
+    Query query;
+    bool is_query = false;
+};
+
+struct _Batch {
+    ThreadPool& pool;
+    size_t limit;
+    ReduceOptions options; //:strategy changes it
+    FILE* out;
+    Arena arena; //parsed expressions
+    std::vector<std::unique_ptr<_Line>> lines;
+    std::vector<bool> read; //per symbol: reached by a query not flushed yet
+
+    _Batch(ThreadPool& pool, size_t limit, const ReduceOptions& options, FILE* out)
+        : pool(pool), limit(limit), options(options), out(out) {}
+
+    void run_line(std::string_view line);
+    void flush();
+};
+
+void _Batch::flush() {
+    if (lines.empty()) return;
+    QueryStats stats; //a flush is one query as far as :stats is concerned
+
+    //every definition gets its normal form here, so the tasks only read
+    for (std::unique_ptr<_Line>& line : lines) {
+        if (line->is_query) prepare_query(line->query);
+    }
+
+    {
+        TaskGroup group(pool);
+        bool shared = query_reads_only(options);
+        for (std::unique_ptr<_Line>& line : lines) {
+            if (!line->is_query) continue;
+            _Line* l = line.get();
+            size_t limit = this->limit;
+            const ReduceOptions* options = &this->options;
+            auto task = [l, limit, options] {
+                Arena arena;
+                ArenaScope scope(&arena);
+                std::string error_text;
+                Expr* reduced = run_query(l->query, *options, error_text);
+                if (!reduced) {
+                    l->text += "ERROR: " + error_text + "\n";
+                } else {
+                    l->text += "REDUCED: ";
+                    print_expr(*reduced, l->text, limit);
+                    l->text += "\n";
+                }
+            };
+            if (shared) {
+                group.spawn(task);
+            } else {
+                task();
+            }
+        }
+        group.wait();
+    }
+
+    std::string buffer;
+    for (std::unique_ptr<_Line>& line : lines) buffer += line->text;
+    fwrite(buffer.data(), 1, buffer.size(), out);
+
+    lines.clear();
+    read.assign(read.size(), false);
+}
+
+void _Batch::run_line(std::string_view text) {
+    //nothing parsed outlives its line, but resetting gives the chunks back to
+    //malloc, so the arena is only cleared once per batch
+    if (lines.empty()) arena.reset();
+    ArenaScope scope(&arena);
+    std::unique_ptr<_Line> line(new _Line);
+
+    if (is_command(text)) {
+        //a command may change any definition
+        flush();
+        run_command(text, options, line->text);
+        lines.push_back(std::move(line));
+        return;
+    }
+
+    auto instr = interpret_expression(text);
+    if (!instr) {
+        line->text = "ERROR: " + get_error_text() + "\n";
+        lines.push_back(std::move(line));
+        return;
+    }
+
+    print_expr(*instr->expr, line->text);
+    if (!instr->assign_to.empty()) {
+        line->text += " [ASSIGNS TO '" + instr->assign_to + "']";
+    }
+    line->text += "\n";
+
+    if (!instr->assign_to.empty()) {
+        //queries before this line must see the old definition
+        Symbol id = intern(instr->assign_to);
+        if (id < read.size() && read[id]) flush();
+        if (!set_variable(instr->assign_to.c_str(), *instr->expr)) {
+            line->text += "ERROR: " + get_error_text() + "\n";
+        }
+    } else if (!compile_query(instr->expr.get(), line->query)) {
+        line->text += "ERROR: " + get_error_text() + "\n";
+    } else {
+        line->is_query = true;
+        for (Symbol sym : line->query.reaches) {
+            if (sym >= read.size()) read.resize(symbol_count(), false);
+            read[sym] = true;
+        }
+    }
+    //the nodes belong to the batch's arena, which frees them all at once
+    instr->expr.release();
+    lines.push_back(std::move(line));
+}
+
+bool run_script(const char* path, unsigned threads, size_t limit, const ReduceOptions& options, FILE* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char* data = nullptr;
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = (const char*)mapped;
+    }
+    close(fd);
+
+    std::unique_ptr<ThreadPool> own_pool;
+    ThreadPool* pool = &ThreadPool::shared();
+    if (threads != 0 && threads != pool->workers() + 1) {
+        own_pool.reset(new ThreadPool(threads - 1));
+        pool = own_pool.get();
+    }
+
+    _Batch batch(*pool, limit, options, out);
+    std::string_view script(data, size);
+    while (!script.empty()) {
+        size_t end = script.find('\n');
+        std::string_view line = script.substr(0, end);
+        script.remove_prefix(end == std::string_view::npos ? script.size() : end + 1);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+        batch.run_line(line);
+    }
+    batch.flush();
+    fflush(out);
+
+    if (data) munmap((void*)data, size);
+    return true;
+}
\ No newline at end of file
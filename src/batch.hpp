@@ -0,0 +1,16 @@
+#pragma once
+
+#include "interp.hpp"
+
+#include <cstddef>
+#include <cstdio>
+
+// Runs every line of a script file and writes what the REPL would print for
+// it to `out`, in the same order. Output lines that do not depend on each
+// other are reduced concurrently: queries are collected until an assignment
+// changes a name one of them reaches, then reduced together on the pool.
+// `threads` counts the calling thread, 0 is one per hardware thread, and
+// results are cut after `limit` bytes. Queries are reduced with `options`, as
+// far as :strategy lines in the script leave them, and one at a time unless
+// query_reads_only(options). Returns false if the file cannot be read.
+bool run_script(const char* path, unsigned threads, size_t limit, const ReduceOptions& options, FILE* out);
\ No newline at end of file
@@ -0,0 +1,437 @@
+#include "bytecode.hpp"
+#include "arena.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An instruction is an opcode word followed by its operands. Locals are
+// numbered per block: local 0 is a lambda block's argument, local i > 0 the
+// block's i-th captured value.
+//
+//   Local i            push local i, forcing it if it is a thunk
+//   Pass i             push local i as it is (lazy arguments)
+//   Global k           push the value of globals[k], running its definition
+//   Closure b n i...   push a closure of block b capturing locals i...
+//   Thunk b n i...     push a thunk of block b capturing locals i...
+//   Apply              pop an argument and a function, push the application
+//   TailApply          the same, in place of the running block
+//   Return             the running block is done, its value is on top
+enum class _Op : uint32_t {
+    Local,
+    Pass,
+    Global,
+    Closure,
+    Thunk,
+    Apply,
+    TailApply,
+    Return
+};
+
+//free variables of every node under a term, as sorted de Bruijn indices in
+//the context the node sits in
+using _FreeVars = std::unordered_map<const Term*, std::vector<uint32_t>>;
+
+static void _free_vars(const Term* root, _FreeVars& free) {
+    std::vector<std::pair<const Term*, bool>> pending; //node, children done
+    pending.push_back({ root, false });
+    while (!pending.empty()) {
+        auto [term, ready] = pending.back();
+        pending.pop_back();
+        if (free.count(term)) continue;
+        if (!ready) {
+            pending.push_back({ term, true });
+            if (term->type == TermType::Lam) {
+                pending.push_back({ term->lam.body, false });
+            } else if (term->type == TermType::App) {
+                pending.push_back({ term->app.rhs, false });
+                pending.push_back({ term->app.lhs, false });
+            }
+            continue;
+        }
+        std::vector<uint32_t> vars;
+        switch (term->type) {
+        case TermType::Var:
+            vars.push_back(term->index);
+            break;
+        case TermType::Lam:
+            for (uint32_t i : free[term->lam.body]) {
+                if (i > 0) vars.push_back(i - 1);
+            }
+            break;
+        case TermType::App: {
+            const auto& lhs = free[term->app.lhs];
+            const auto& rhs = free[term->app.rhs];
+            std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(vars));
+            break;
+        }
+        case TermType::Global:
+            break;
+        }
+        free.emplace(term, std::move(vars));
+    }
+}
+
+struct _Compiler {
+    struct Block {
+        const Term* term;   //a lambda, or the term a thunk delays
+        bool lambda;
+    };
+
+    Bytecode& out;
+    _FreeVars free;
+    std::unordered_map<const Term*, uint32_t> globals;
+    std::vector<Block> blocks; //blocks still to emit, by index
+
+    void emit(uint32_t word) { out.code.push_back(word); }
+    void emit(_Op op) { out.code.push_back((uint32_t)op); }
+
+    uint32_t block(const Term* term, bool lambda) {
+        uint32_t index = (uint32_t)out.blocks.size();
+        const auto& captures = free[term];
+        out.blocks.push_back({ 0, (uint32_t)captures.size(), lambda ? term->lam.hint : NO_SYMBOL });
+        blocks.push_back({ term, lambda });
+        return index;
+    }
+
+    //a closure or thunk of a new block, capturing what it needs of the block
+    //being emitted
+    void capture(_Op op, const Term* term, const Block& in) {
+        uint32_t index = block(term, op == _Op::Closure);
+        const auto& captures = free[term];
+        emit(op);
+        emit(index);
+        emit((uint32_t)captures.size());
+        for (uint32_t i : captures) emit(local(in, i));
+    }
+
+    //local slot of de Bruijn index `i` in the body of `in`
+    uint32_t local(const Block& in, uint32_t i) {
+        if (in.lambda && i == 0) return 0;
+        if (in.lambda) i--;
+        const auto& captures = free[in.term];
+        return 1 + (uint32_t)(std::lower_bound(captures.begin(), captures.end(), i) - captures.begin());
+    }
+
+    void body(Block in) {
+        enum class Step : uint8_t { Value, Arg, Apply, TailApply };
+        std::vector<std::pair<const Term*, Step>> pending;
+        pending.push_back({ in.lambda ? in.term->lam.body : in.term, Step::Value });
+        bool tail = true; //the next Value is the block's result
+
+        while (!pending.empty()) {
+            auto [term, step] = pending.back();
+            pending.pop_back();
+            if (step == Step::Apply || step == Step::TailApply) {
+                emit(step == Step::Apply ? _Op::Apply : _Op::TailApply);
+                continue;
+            }
+            bool result = tail;
+            tail = false;
+            if (step == Step::Arg && out.lazy && term->type != TermType::Var && term->type != TermType::Lam) {
+                capture(_Op::Thunk, term, in);
+                continue;
+            }
+            switch (term->type) {
+            case TermType::Var:
+                emit(step == Step::Arg && out.lazy ? _Op::Pass : _Op::Local);
+                emit(local(in, term->index));
+                break;
+            case TermType::Lam:
+                capture(_Op::Closure, term, in);
+                break;
+            case TermType::App:
+                pending.push_back({ nullptr, result ? Step::TailApply : Step::Apply });
+                pending.push_back({ term->app.rhs, Step::Arg });
+                pending.push_back({ term->app.lhs, Step::Value });
+                continue;
+            case TermType::Global: {
+                auto [it, added] = globals.try_emplace(term, (uint32_t)out.globals.size());
+                if (added) out.globals.push_back(term);
+                emit(_Op::Global);
+                emit(it->second);
+                break;
+            }
+            }
+            if (result) emit(_Op::Return);
+        }
+    }
+};
+
+Bytecode* bytecode_compile(const Term* term, bool lazy) {
+    auto* out = new Bytecode();
+    out->lazy = lazy;
+    _Compiler compiler{ *out, {}, {}, {} };
+    _free_vars(term, compiler.free);
+    compiler.block(term, false);
+    for (size_t i = 0; i < compiler.blocks.size(); i++) {
+        out->blocks[i].entry = (uint32_t)out->code.size();
+        compiler.body(compiler.blocks[i]);
+    }
+    return out;
+}
+
+enum class _VmTag : uint8_t {
+    Closure,
+    Thunk,
+    NVar,
+    NApp
+};
+
+//closures and thunks keep their captured values inline, after the header
+struct _VmValue {
+    _VmTag tag;
+    uint32_t level; //NVar
+    Symbol centre;  //global whose code created the value, for the profile
+    union {
+        //a thunk being forced has no block, and a forced one has its result
+        struct { const Bytecode* code; const BytecodeBlock* block; _VmValue* result; } fn;
+        struct { _VmValue* fn; _VmValue* arg; } napp;
+    };
+
+    _VmValue** captured() { return reinterpret_cast<_VmValue**>(this + 1); }
+};
+
+static _VmValue* _value_new(Arena* arena, _VmTag tag, uint32_t captures = 0) {
+    auto* value = static_cast<_VmValue*>(arena->alloc(sizeof(_VmValue) + captures * sizeof(_VmValue*)));
+    value->tag = tag;
+    value->level = 0;
+    value->centre = stat_centre();
+    return value;
+}
+
+struct _VmFrame {
+    const uint32_t* pc;
+    const Bytecode* code;
+    _VmValue* self;   //closure or thunk whose block runs, nullptr for block 0
+    _VmValue* arg;
+    _VmValue* update; //thunk to store the result in
+    Symbol centre;  //the caller's, restored on return
+};
+
+struct _Vm {
+    EvalContext& ctx;
+    Arena* arena;
+    std::vector<_VmValue*> values;
+    std::vector<_VmFrame> frames;
+    //definitions compiled for this run, when the context keeps no code
+    std::unordered_map<const Term*, std::unique_ptr<Bytecode>> compiled;
+
+    const Bytecode* definition(const Term* global);
+    bool force(_VmValue* thunk);
+    void leave();
+    _VmValue* run(size_t base);
+    _VmValue* apply(_VmValue* fn, _VmValue* arg);
+    Term* quote(_VmValue* value);
+};
+
+const Bytecode* _Vm::definition(const Term* global) {
+    using namespace std::string_literals;
+
+    const Bytecode* code = nullptr;
+    if (ctx.code) {
+        code = ctx.code(ctx.env, global, ctx.lazy);
+    } else if (const Term* def = ctx.resolve(global)) {
+        auto& slot = compiled[def];
+        if (!slot) slot.reset(bytecode_compile(def, ctx.lazy));
+        code = slot.get();
+    }
+    if (!code) ctx.error = "variable "s + symbol_cstr(global->global.id) + " is not assigned";
+    return code;
+}
+
+//starts running the block of an unforced thunk
+bool _Vm::force(_VmValue* thunk) {
+    if (!thunk->fn.block) {
+        ctx.error = "argument depends on its own value";
+        return false;
+    }
+    STAT_INC(thunks_forced);
+    frames.push_back({ thunk->fn.code->code.data() + thunk->fn.block->entry, thunk->fn.code, thunk, nullptr, thunk, stat_centre() });
+    stat_set_centre(thunk->centre);
+    thunk->fn.block = nullptr;
+    return true;
+}
+
+void _Vm::leave() {
+    _VmFrame& frame = frames.back();
+    if (frame.update) frame.update->fn.result = values.back();
+    stat_set_centre(frame.centre);
+    frames.pop_back();
+}
+
+//runs until the frames above `base` have returned, and pops their value
+_VmValue* _Vm::run(size_t base) {
+    while (frames.size() > base) {
+        _VmFrame* frame = &frames.back();
+        _Op op = (_Op)*frame->pc++;
+        switch (op) {
+        case _Op::Local:
+        case _Op::Pass: {
+            uint32_t i = *frame->pc++;
+            _VmValue* value = i ? frame->self->captured()[i - 1] : frame->arg;
+            if (op == _Op::Local && value->tag == _VmTag::Thunk) {
+                if (!value->fn.result) {
+                    if (!force(value)) return nullptr;
+                    break;
+                }
+                value = value->fn.result;
+            }
+            values.push_back(value);
+            break;
+        }
+        case _Op::Global: {
+            const Term* global = frame->code->globals[*frame->pc++];
+            stat_enter_global(global->global.id);
+            const Bytecode* code = definition(global);
+            if (!code) return nullptr;
+            frames.push_back({ code->code.data() + code->blocks[0].entry, code, nullptr, nullptr, nullptr, stat_centre() });
+            stat_set_centre(global->global.id);
+            break;
+        }
+        case _Op::Closure:
+        case _Op::Thunk: {
+            const BytecodeBlock* block = &frame->code->blocks[*frame->pc++];
+            uint32_t n = *frame->pc++;
+            _VmValue* value = _value_new(arena, op == _Op::Closure ? _VmTag::Closure : _VmTag::Thunk, n);
+            value->fn.code = frame->code;
+            value->fn.block = block;
+            value->fn.result = nullptr;
+            for (uint32_t k = 0; k < n; k++) {
+                uint32_t i = *frame->pc++;
+                value->captured()[k] = i ? frame->self->captured()[i - 1] : frame->arg;
+            }
+            values.push_back(value);
+            break;
+        }
+        case _Op::Apply:
+        case _Op::TailApply: {
+            _VmValue* arg = values.back();
+            values.pop_back();
+            _VmValue* fn = values.back();
+            values.pop_back();
+            if (fn->tag != _VmTag::Closure) {
+                _VmValue* app = _value_new(arena, _VmTag::NApp);
+                app->napp.fn = fn;
+                app->napp.arg = arg;
+                values.push_back(app);
+                if (op == _Op::TailApply) leave();
+                break;
+            }
+            ctx.held_bytes = values.capacity() * sizeof(_VmValue*) + frames.capacity() * sizeof(_VmFrame);
+            if (!ctx.step()) return nullptr;
+            stat_step(fn->centre);
+            const uint32_t* entry = fn->fn.code->code.data() + fn->fn.block->entry;
+            if (op == _Op::TailApply) {
+                //the caller's frame is done with, the callee returns in its place
+                frame->pc = entry;
+                frame->code = fn->fn.code;
+                frame->self = fn;
+                frame->arg = arg;
+            } else {
+                frames.push_back({ entry, fn->fn.code, fn, arg, nullptr, stat_centre() });
+                stat_depth(frames.size());
+            }
+            stat_set_centre(fn->centre);
+            break;
+        }
+        case _Op::Return:
+            leave();
+            break;
+        }
+    }
+    _VmValue* value = values.back();
+    values.pop_back();
+    return value;
+}
+
+_VmValue* _Vm::apply(_VmValue* fn, _VmValue* arg) {
+    ctx.held_bytes = values.capacity() * sizeof(_VmValue*) + frames.capacity() * sizeof(_VmFrame);
+    if (!ctx.step()) return nullptr;
+    stat_step(fn->centre);
+    frames.push_back({ fn->fn.code->code.data() + fn->fn.block->entry, fn->fn.code, fn, arg, nullptr, stat_centre() });
+    stat_set_centre(fn->centre);
+    return run(frames.size() - 1);
+}
+
+Term* _Vm::quote(_VmValue* root) {
+    enum class Step : uint8_t { Quote, Lam, App };
+    struct Pending { Step step; uint32_t depth; union { _VmValue* value; Symbol hint; }; };
+
+    std::vector<Pending> pending;
+    std::vector<Term*> built;
+    auto fail = [&]() -> Term* {
+        for (Term* term : built) term_release(term);
+        return nullptr;
+    };
+
+    pending.push_back({ Step::Quote, 0, { root } });
+    while (!pending.empty()) {
+        Pending next = pending.back();
+        pending.pop_back();
+        switch (next.step) {
+        case Step::Quote: {
+            _VmValue* value = next.value;
+            if (value->tag == _VmTag::Thunk) {
+                if (!value->fn.result && (!force(value) || !run(frames.size() - 1))) return fail();
+                value = value->fn.result;
+            }
+            switch (value->tag) {
+            case _VmTag::Closure: {
+                _VmValue* var = _value_new(arena, _VmTag::NVar);
+                var->level = next.depth;
+                Symbol hint = value->fn.block->hint;
+                _VmValue* body = apply(value, var);
+                if (!body) return fail();
+                Pending lam{ Step::Lam, next.depth, {} };
+                lam.hint = hint;
+                pending.push_back(lam);
+                pending.push_back({ Step::Quote, next.depth + 1, { body } });
+                break;
+            }
+            case _VmTag::NVar:
+                built.push_back(term_var(next.depth - 1 - value->level));
+                break;
+            case _VmTag::NApp:
+                pending.push_back({ Step::App, next.depth, {} });
+                pending.push_back({ Step::Quote, next.depth, { value->napp.arg } });
+                pending.push_back({ Step::Quote, next.depth, { value->napp.fn } });
+                break;
+            case _VmTag::Thunk:
+                break;
+            }
+            break;
+        }
+        case Step::Lam:
+            built.back() = term_lam(next.hint, built.back());
+            break;
+        case Step::App: {
+            Term* arg = built.back();
+            built.pop_back();
+            built.back() = term_app(built.back(), arg);
+            break;
+        }
+        }
+    }
+    return built.back();
+}
+
+Term* vm_normalize_term(const Term* term, EvalContext& ctx) {
+    std::unique_ptr<Bytecode> code(bytecode_compile(term, ctx.lazy));
+    _Vm vm{ ctx, Arena::current(), {}, {}, {} };
+    //the stacks live outside the arena, failing to grow them ends the run like the memory limit does
+    try {
+        vm.frames.push_back({ code->code.data() + code->blocks[0].entry, code.get(), nullptr, nullptr, nullptr, stat_centre() });
+        _VmValue* value = vm.run(0);
+        if (!value) return nullptr;
+        return vm.quote(value);
+    } catch (const std::bad_alloc&) {
+        ctx.error = "out of memory";
+        return nullptr;
+    }
+}
\ No newline at end of file
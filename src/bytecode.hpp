@@ -0,0 +1,38 @@
+#pragma once
+
+#include "eval.hpp"
+#include "symbol.hpp"
+#include "term.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// A term compiled to linear code for the bytecode VM. Each lambda becomes a
+// block of instructions that finds its argument and the values it captured in
+// one flat closure, so running it never walks the term again; lazy code also
+// gives every argument that has to be delayed a block of its own. Block 0
+// evaluates the term itself.
+//
+// The code points at Global nodes of the term it was compiled from, so that
+// term must outlive it.
+struct BytecodeBlock {
+    uint32_t entry;     //offset of the block's first instruction in `code`
+    uint32_t captures;  //values a closure or thunk of the block holds
+    Symbol hint;        //lambda blocks: the binder name
+};
+
+struct Bytecode {
+    bool lazy;
+    std::vector<uint32_t> code;
+    std::vector<BytecodeBlock> blocks;
+    std::vector<const Term*> globals; //operands of Global instructions
+};
+
+// Compiles `term` for strict or lazy evaluation.
+Bytecode* bytecode_compile(const Term* term, bool lazy);
+
+// Same contract as normalize_term, but compiles the term and runs the code on
+// a VM loop with explicit stacks. Definitions run the code `ctx.code` keeps
+// for them when it is set, and are compiled for the duration of the call
+// otherwise.
+Term* vm_normalize_term(const Term* term, EvalContext& ctx);
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "command.hpp"
+#include "arena.hpp"
+#include "interp.hpp"
+#include "stats.hpp"
+#include "symbol.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+using namespace std::string_literals;
+
+bool is_command(std::string_view line) {
+    size_t start = line.find_first_not_of(" \t");
+    return start != std::string_view::npos && line[start] == ':';
+}
+
+static std::string_view _next_word(std::string_view& line) {
+    size_t start = 0;
+    while (start < line.size() && std::isspace((unsigned char)line[start])) start++;
+    size_t end = start;
+    while (end < line.size() && !std::isspace((unsigned char)line[end])) end++;
+    std::string_view word = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return word;
+}
+
+static void _append_stats(std::string& out, const char* label, const ReductionStats& s) {
+    char text[512];
+    snprintf(text, sizeof(text),
+        "%s: queries %llu, steps %llu, lookups %llu, normalizations %llu, thunks forced %llu, deltas %llu, peak depth %llu, "
+        "index probes %llu, tokens %llu, exprs %llu (%llu copies), "
+        "parse %.3f ms, compile %.3f ms, eval %.3f ms, read back %.3f ms\n",
+        label, (unsigned long long)s.queries, (unsigned long long)s.steps, (unsigned long long)s.lookups,
+        (unsigned long long)s.normalizations, (unsigned long long)s.thunks_forced, (unsigned long long)s.deltas,
+        (unsigned long long)s.peak_depth,
+        (unsigned long long)s.index_probes, (unsigned long long)s.tokens, (unsigned long long)s.exprs,
+        (unsigned long long)s.expr_copies, s.parse_ns / 1e6, s.compile_ns / 1e6, s.eval_ns / 1e6, s.read_back_ns / 1e6);
+    out += text;
+}
+
+static void _stats(const std::string& argument, std::string& out) {
+    if (!stats_enabled()) {
+        out += "ERROR: statistics are compiled out (LAMBDA_STATS=OFF)\n";
+        return;
+    }
+    if (argument == "reset") {
+        reset_stats();
+        reset_alloc_stats();
+        out += "STATS RESET\n";
+        return;
+    }
+    if (!argument.empty()) {
+        out += "ERROR: :stats takes no argument but reset\n";
+        return;
+    }
+
+    _append_stats(out, "LAST", last_query_stats());
+    _append_stats(out, "TOTAL", get_stats());
+    AllocStats allocs = get_alloc_stats();
+    char text[256];
+    snprintf(text, sizeof(text), "ALLOCATIONS: heap %zu (%zu freed), arena %zu (%zu reused), arena bytes %zu\n",
+        allocs.heap_allocs, allocs.heap_frees, allocs.arena_allocs, allocs.arena_reuses, allocs.arena_bytes);
+    out += text;
+}
+
+//`:profile on|off|reset`, or the globals that took the most steps
+static void _profile(const std::string& argument, std::string& out) {
+    if (!stats_enabled()) {
+        out += "ERROR: statistics are compiled out (LAMBDA_STATS=OFF)\n";
+        return;
+    }
+    if (argument == "on" || argument == "off") {
+        set_profiling(argument == "on");
+        out += "PROFILING " + std::string(argument == "on" ? "ON" : "OFF") + "\n";
+        return;
+    }
+    if (argument == "reset") {
+        reset_profile();
+        out += "PROFILE RESET\n";
+        return;
+    }
+
+    size_t count = argument.empty() ? 20 : strtoull(argument.c_str(), nullptr, 10);
+    std::vector<ProfileEntry> entries = get_profile();
+    out += profiling() ? "PROFILE:\n" : "PROFILE (off, :profile on starts it):\n";
+    out += "       steps    entries  global\n";
+    for (size_t i = 0; i < entries.size() && i < count; i++) {
+        char text[64];
+        snprintf(text, sizeof(text), "%12llu %10llu  ", (unsigned long long)entries[i].steps,
+            (unsigned long long)entries[i].entries);
+        out += text;
+        out += entries[i].global == NO_SYMBOL ? "(query)" : std::string(symbol_name(entries[i].global));
+        out += "\n";
+    }
+}
+
+static const char* const _STRATEGIES[] = { "applicative", "normal", "whnf", "hnf" }; //in Strategy order
+
+//`:strategy <name>`, or the strategy in use
+static void _strategy(const std::string& argument, ReduceOptions& options, std::string& out) {
+    if (argument.empty()) {
+        out += "STRATEGY "s + _STRATEGIES[(int)options.strategy] + "\n";
+        return;
+    }
+    size_t i = 0;
+    while (i < std::size(_STRATEGIES) && argument != _STRATEGIES[i]) i++;
+    if (i == std::size(_STRATEGIES)) {
+        out += "ERROR: unknown strategy " + argument + "\n";
+        return;
+    }
+    ReduceOptions chosen = options;
+    chosen.strategy = (Strategy)i;
+    if (const char* error = options_error(chosen)) {
+        out += "ERROR: "s + error + "\n";
+        return;
+    }
+    options = chosen;
+    out += "STRATEGY "s + _STRATEGIES[i] + "\n";
+}
+
+void run_command(std::string_view line, ReduceOptions& options, std::string& out) {
+    std::string_view name = _next_word(line);
+    std::string argument(_next_word(line));
+    if (!_next_word(line).empty()) {
+        out += "ERROR: too many arguments to "s + std::string(name) + "\n";
+        return;
+    }
+
+    bool save = name == ":save";
+    if (save || name == ":load") {
+        if (argument.empty()) {
+            out += "ERROR: "s + std::string(name) + " needs a file name\n";
+        } else if (!(save ? save_snapshot(argument.c_str()) : load_snapshot(argument.c_str()))) {
+            out += "ERROR: " + get_error_text() + "\n";
+        } else {
+            out += (save ? "SAVED TO '" : "LOADED FROM '") + argument + "'\n";
+        }
+        return;
+    }
+
+    if (name == ":stats") {
+        _stats(argument, out);
+        return;
+    }
+    if (name == ":profile") {
+        _profile(argument, out);
+        return;
+    }
+    if (name == ":strategy") {
+        _strategy(argument, options, out);
+        return;
+    }
+
+    out += "ERROR: unknown command "s + std::string(name) + "\n";
+}
\ No newline at end of file
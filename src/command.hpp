@@ -0,0 +1,23 @@
+#pragma once
+
+#include "interp.hpp"
+
+#include <string>
+#include <string_view>
+
+// Lines starting with ':' are commands to the interpreter rather than
+// expressions. They act on the default session, or on the options later
+// queries are reduced with:
+//
+//   :save <path>   writes every definition to a snapshot file
+//   :load <path>   assigns every definition in a snapshot file
+//   :stats [reset] counters of the last line (in a script, the last batch of
+//                  queries run together) and of the whole process
+//   :profile [on|off|reset|<count>]
+//                  per-global reduction steps, most expensive first
+//   :strategy [applicative|normal|whnf|hnf]
+//                  how far and in which order queries are reduced
+bool is_command(std::string_view line);
+
+// Runs a command and appends what it prints, newline included, to `out`.
+void run_command(std::string_view line, ReduceOptions& options, std::string& out);
\ No newline at end of file
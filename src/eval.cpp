@@ -0,0 +1,301 @@
+#include "eval.hpp"
+#include "native.hpp"
+#include "value.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include <pthread.h>
+
+//lowest address the evaluators may recurse down to on this thread, leaving an
+//eighth of the stack for reading back and unwinding
+static uintptr_t _stack_floor() {
+    static thread_local uintptr_t floor = [] {
+        uintptr_t low = 0;
+#ifdef __GLIBC__
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            void* addr;
+            size_t size;
+            if (pthread_attr_getstack(&attr, &addr, &size) == 0) low = (uintptr_t)addr + std::max<size_t>(size / 8, 64 * 1024);
+            pthread_attr_destroy(&attr);
+        }
+#endif
+        return low;
+    }();
+    return floor;
+}
+
+void EvalContext::start(const Arena* values) {
+    stack_floor = _stack_floor();
+    arena = values;
+    base_bytes = values ? values->bytes_reserved() : 0;
+    base_nodes = TermFactory::current()->stats().live_nodes;
+}
+
+bool EvalContext::check_limits() {
+    if (deadline != std::chrono::steady_clock::time_point{} && std::chrono::steady_clock::now() > deadline) {
+        error = "time limit reached";
+        return false;
+    }
+    if ((cancelled && cancelled->load(std::memory_order_relaxed)) || (abandoned && abandoned->load(std::memory_order_relaxed))) {
+        error = "evaluation cancelled";
+        return false;
+    }
+    if (max_bytes) {
+        size_t bytes = held_bytes;
+        if (arena && arena->bytes_reserved() > base_bytes) bytes += arena->bytes_reserved() - base_bytes;
+        size_t nodes = TermFactory::current()->stats().live_nodes;
+        if (nodes > base_nodes) bytes += (nodes - base_nodes) * sizeof(Term);
+        if (bytes > max_bytes) {
+            error = "memory limit reached";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EvalContext::claim_steps() {
+    if (!step_pool) return false;
+    //every claim comes once the steps taken before are used up
+    if (max_steps != 0) step_pool->holders.fetch_sub(1);
+    while (true) {
+        uint64_t left = step_pool->left.load();
+        if (left != 0) {
+            uint64_t take = left < 1024 ? left : 1024;
+            if (!step_pool->left.compare_exchange_weak(left, left - take)) continue;
+            step_pool->holders.fetch_add(1);
+            max_steps = steps - 1 + take;
+            return true;
+        }
+        //a holder gives its steps back before it stops holding
+        if (step_pool->holders.load() == 0 && step_pool->left.load() == 0) break;
+        std::this_thread::yield();
+    }
+    max_steps = 0;
+    return false;
+}
+
+void EvalContext::return_steps() {
+    if (!step_pool || max_steps == 0) return;
+    if (steps < max_steps) step_pool->left.fetch_add(max_steps - steps);
+    step_pool->holders.fetch_sub(1);
+    max_steps = 0;
+}
+
+Value* Evaluator::eval(const Term* term, const Env* env) {
+    using namespace std::string_literals;
+    if (!ctx.within_stack()) return nullptr;
+
+    switch (term->type) {
+    case TermType::Var:
+        return force(env->lookup(term->index));
+    case TermType::Lam: {
+        Value* v = value_new(arena, ValueType::Closure);
+        v->closure.hint = term->lam.hint;
+        v->closure.body = term->lam.body;
+        v->closure.env = env;
+        return v;
+    }
+    case TermType::App: {
+        Value* fn = eval(term->app.lhs, env);
+        if (!fn) return nullptr;
+        Value* arg = ctx.lazy ? thunk_new(arena, term->app.rhs, env) : eval(term->app.rhs, env);
+        if (!arg) return nullptr;
+        return apply(fn, arg);
+    }
+    case TermType::Global: {
+        stat_enter_global(term->global.id);
+        const Term* def = ctx.resolve(term);
+        if (!def) {
+            ctx.error = "variable "s + symbol_cstr(term->global.id) + " is not assigned";
+            return nullptr;
+        }
+        Symbol caller = stat_centre();
+        stat_set_centre(term->global.id);
+        Value* v = ctx.native ? ctx.native->eval_global(term, def, *this) : eval(def, empty);
+        stat_set_centre(caller);
+        return v;
+    }
+    }
+    return nullptr;
+}
+
+Value* Evaluator::force(Value* v) {
+    if (v->type != ValueType::Thunk) return v;
+    if (v->thunk.result) return v->thunk.result;
+    if (thunk_is_forcing(v)) {
+        ctx.error = "argument depends on its own value";
+        return nullptr;
+    }
+
+    const Term* term = v->thunk.term;
+    v->thunk.term = nullptr;
+    STAT_INC(thunks_forced);
+    Symbol caller = stat_centre();
+    stat_set_centre(v->centre);
+    Value* result = eval(term, v->thunk.env);
+    stat_set_centre(caller);
+    if (!result) return nullptr;
+    v->thunk.result = result;
+    return result;
+}
+
+Value* Evaluator::apply(Value* fn, Value* arg) {
+    if (fn->type == ValueType::Closure) {
+        if (!ctx.step()) return nullptr;
+        stat_step(fn->centre);
+        STAT_DEPTH();
+        Symbol caller = stat_centre();
+        stat_set_centre(fn->centre);
+        Value* v = eval(fn->closure.body, env_extend(arena, fn->closure.env, arg));
+        stat_set_centre(caller);
+        return v;
+    }
+    if (fn->type != ValueType::NVar && fn->type != ValueType::NApp) return ctx.native->apply(fn, arg, *this);
+
+    Value* v = value_new(arena, ValueType::NApp);
+    v->napp.fn = fn;
+    v->napp.arg = arg;
+    return v;
+}
+
+Term* Evaluator::quote(Value* v, uint32_t depth) {
+    if (!ctx.within_stack()) return nullptr;
+    switch (v->type) {
+    case ValueType::Closure:
+    case ValueType::Numeral:
+    case ValueType::NumeralFn:
+    case ValueType::Boolean:
+    case ValueType::BooleanFn: {
+        Value* var = value_new(arena, ValueType::NVar);
+        var->level = depth;
+        Value* body = apply(v, var);
+        if (!body) return nullptr;
+        Term* quoted = quote(body, depth + 1);
+        if (!quoted) return nullptr;
+        return term_lam(value_hint(v), quoted);
+    }
+    case ValueType::Delta: {
+        Value* expanded = ctx.native->expand(v, *this);
+        if (!expanded) return nullptr;
+        return quote(expanded, depth);
+    }
+    case ValueType::NVar:
+        return term_var(depth - 1 - v->level);
+    case ValueType::Thunk: {
+        Value* forced = force(v);
+        if (!forced) return nullptr;
+        return quote(forced, depth);
+    }
+    case ValueType::NApp: {
+        Term* fn = quote(v->napp.fn, depth);
+        if (!fn) return nullptr;
+        Term* arg = quote(v->napp.arg, depth);
+        if (!arg) {
+            term_release(fn);
+            return nullptr;
+        }
+        return term_app(fn, arg);
+    }
+    }
+    return nullptr;
+}
+
+Term* normalize_term(const Term* term, EvalContext& ctx) {
+    Evaluator ev(Arena::current(), ctx);
+    Value* v = ev.eval(term, ev.empty);
+    if (!v) return nullptr;
+    return ev.quote(v, 0);
+}
+
+//`term` with the values of its free variables read back from `env`, nothing
+//reduced. `bound` lambdas of it enclose the position, `depth` of the result
+static Term* _substitute(Evaluator& ev, const Term* term, const Env* env, uint32_t bound, uint32_t depth);
+
+//`v` read back without reducing anything further
+static Term* _quote_weak(Evaluator& ev, Value* v, uint32_t depth) {
+    if (!ev.ctx.within_stack()) return nullptr;
+    switch (v->type) {
+    case ValueType::Closure: {
+        Term* body = _substitute(ev, v->closure.body, v->closure.env, 1, depth + 1);
+        if (!body) return nullptr;
+        return term_lam(v->closure.hint, body);
+    }
+    case ValueType::NVar:
+        return term_var(depth - 1 - v->level);
+    case ValueType::NApp: {
+        Term* fn = _quote_weak(ev, v->napp.fn, depth);
+        if (!fn) return nullptr;
+        Term* arg = _quote_weak(ev, v->napp.arg, depth);
+        if (!arg) {
+            term_release(fn);
+            return nullptr;
+        }
+        return term_app(fn, arg);
+    }
+    case ValueType::Thunk:
+        if (v->thunk.result) return _quote_weak(ev, v->thunk.result, depth);
+        return _substitute(ev, v->thunk.term, v->thunk.env, 0, depth);
+    default:
+        ev.ctx.error = "native values cannot be read back unevaluated";
+        return nullptr;
+    }
+}
+
+static Term* _substitute(Evaluator& ev, const Term* term, const Env* env, uint32_t bound, uint32_t depth) {
+    if (!ev.ctx.within_stack()) return nullptr;
+    switch (term->type) {
+    case TermType::Var:
+        if (term->index < bound) return term_var(term->index);
+        return _quote_weak(ev, env->lookup(term->index - bound), depth);
+    case TermType::Lam: {
+        Term* body = _substitute(ev, term->lam.body, env, bound + 1, depth + 1);
+        if (!body) return nullptr;
+        return term_lam(term->lam.hint, body);
+    }
+    case TermType::App: {
+        Term* lhs = _substitute(ev, term->app.lhs, env, bound, depth);
+        if (!lhs) return nullptr;
+        Term* rhs = _substitute(ev, term->app.rhs, env, bound, depth);
+        if (!rhs) {
+            term_release(lhs);
+            return nullptr;
+        }
+        return term_app(lhs, rhs);
+    }
+    case TermType::Global:
+        return term_global(term->global.id);
+    }
+    return nullptr;
+}
+
+//evaluates under lambdas until the body is stuck, then reads back the rest
+//as it is
+static Term* _quote_head(Evaluator& ev, Value* v, uint32_t depth) {
+    if (!ev.ctx.within_stack()) return nullptr;
+    if (v->type != ValueType::Closure) return _quote_weak(ev, v, depth);
+    Value* var = value_new(ev.arena, ValueType::NVar);
+    var->level = depth;
+    Value* body = ev.apply(v, var);
+    if (!body) return nullptr;
+    Term* quoted = _quote_head(ev, body, depth + 1);
+    if (!quoted) return nullptr;
+    return term_lam(v->closure.hint, quoted);
+}
+
+Term* whnf_term(const Term* term, EvalContext& ctx) {
+    ctx.lazy = true;
+    Evaluator ev(Arena::current(), ctx);
+    Value* v = ev.eval(term, ev.empty);
+    if (!v) return nullptr;
+    return _quote_weak(ev, v, 0);
+}
+
+Term* hnf_term(const Term* term, EvalContext& ctx) {
+    ctx.lazy = true;
+    Evaluator ev(Arena::current(), ctx);
+    Value* v = ev.eval(term, ev.empty);
+    if (!v) return nullptr;
+    return _quote_head(ev, v, 0);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "symbol.hpp"
+#include "term.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Looks up the compiled definition of a Global term in `env`, nullptr if
+// unassigned.
+using GlobalLookup = const Term* (*)(void* env, const Term* global);
+
+struct Arena;
+struct Native;
+struct Bytecode;
+
+// Looks up the code compiled from the definition of a Global term, for strict
+// or lazy evaluation, nullptr if unassigned. The code stays valid until the
+// definition changes.
+using CodeLookup = const Bytecode* (*)(void* env, const Term* global, bool lazy);
+
+// Steps left to evaluations on several threads that share one step limit,
+// see EvalContext::claim_steps.
+struct StepPool {
+    std::atomic<uint64_t> left;
+    std::atomic<uint32_t> holders = 0; //contexts that took steps they may still give back
+};
+
+// Every evaluation runs under the limits below and fails with an error
+// instead of running away. The step count and the depth of the C++ stack are
+// checked on every closure entry; the clock, the cancellation flag and memory
+// every few thousand.
+struct EvalContext {
+    GlobalLookup lookup;
+    void* env = nullptr; //environment the lookup reads
+    bool lazy = false; //bind arguments as shared thunks instead of evaluating them first
+    uint64_t max_steps = 0; //0 means no limit
+    uint64_t steps = 0; //closures entered so far
+    StepPool* step_pool = nullptr; //shares max_steps with other threads, see claim_steps
+    std::chrono::steady_clock::time_point deadline{}; //the default means none
+    const std::atomic<bool>* cancelled = nullptr; //another thread sets it to stop the evaluation
+    const std::atomic<bool>* abandoned = nullptr; //set once another part of the same evaluation failed
+    size_t max_bytes = 0; //memory the evaluation may take, see start; 0 means no limit
+    Native* native = nullptr; //recursive evaluator only: Church numerals as literals, see native.hpp
+    CodeLookup code = nullptr; //bytecode VM only: compiled definitions kept between runs, see bytecode.hpp
+    std::string error;
+
+    size_t held_bytes = 0; //memory a backend holds outside the arena, kept up to date by the backend
+    uint64_t ticks = 0; //work other than steps, see tick
+
+    //set by start
+    uintptr_t stack_floor = 0; //stack addresses below this one are too deep to keep recursing
+    const Arena* arena = nullptr;
+    size_t base_bytes = 0;
+    size_t base_nodes = 0;
+
+    const Term* resolve(const Term* global) const { return lookup(env, global); }
+
+    // Makes the limits count from here, on the thread that evaluates: the
+    // stack guard for this thread, and memory as the growth of `arena`, where
+    // the values live, plus term nodes built in the current factory.
+    void start(const Arena* values);
+
+    // False once the C++ stack is too deep for the recursive evaluator and
+    // read-back to go on, checked on every recursion as well as every step.
+    bool within_stack() {
+        if ((uintptr_t)__builtin_frame_address(0) >= stack_floor) return true;
+        error = "recursion too deep";
+        return false;
+    }
+
+    // Counts one closure entry, false once a limit is exceeded.
+    bool step() {
+        if (++steps > max_steps && (max_steps != 0 || step_pool) && !claim_steps()) {
+            error = "step limit reached";
+            return false;
+        }
+        if (!within_stack()) return false;
+        return (steps & 4095) != 0 || check_limits();
+    }
+
+    // Counts a unit of work that enters no closure, for backends that can run
+    // long between steps. False once the clock, cancellation or memory limit
+    // is exceeded.
+    bool tick() { return (++ticks & 4095) != 0 || check_limits(); }
+
+    bool check_limits();
+
+    // With a step pool, max_steps is the count this context may reach on the
+    // steps it holds. Takes a batch of the steps left, so evaluations on
+    // several threads share one limit without touching the pool on every step.
+    // While the pool is empty but others hold steps they may give back, waits
+    // for them; false once no steps are left anywhere.
+    bool claim_steps();
+    // Gives the steps taken from the pool and not used back to it. A context
+    // must do so before it waits for another one, which may need them; it
+    // claims again on its next step.
+    void return_steps();
+};
+
+// Computes the normal form of `term` by evaluating it to closures and reading
+// the result back under binders. Intermediate values are allocated in the
+// current arena, so one must be active. Returns a new reference to the normal
+// form, or nullptr and sets `ctx.error` on failure.
+Term* normalize_term(const Term* term, EvalContext& ctx);
+
+// Same contract, but evaluation stops at the weak head normal form: a lambda
+// is returned as written, with the values of its free variables substituted
+// in, and the arguments of a stuck application are not evaluated at all.
+// Arguments are passed unevaluated whatever `ctx.lazy` says, and `ctx.native`
+// must be null.
+Term* whnf_term(const Term* term, EvalContext& ctx);
+
+// Like whnf_term, but also evaluates under leading lambdas until the body is a
+// variable applied to arguments, which are again left unevaluated.
+Term* hnf_term(const Term* term, EvalContext& ctx);
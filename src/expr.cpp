@@ -1,55 +1,63 @@
 #include "expr.hpp"
+#include "arena.hpp"
+#include "printer.hpp"
+#include "stats.hpp"
 
-#include <sstream>
 #include <string.h>
 #include <stdlib.h>
 #include <utility>
 
-static const char* _cp_sv(std::string_view sv) {
-    char* ptr = (char*)malloc(sv.size() + 1);
-    memcpy(ptr, sv.data(), sv.size());
-    ptr[sv.size()] = '\0';
-    return ptr;
+static bool _arena_active() {
+    return Arena::current() != nullptr;
+}
+
+void* Expr::operator new(size_t size) {
+    STAT_INC(exprs);
+    return node_alloc(size);
+}
+
+void Expr::operator delete(Expr* e, std::destroying_delete_t) {
+    bool in_arena = e->_node_arena;
+    e->~Expr();
+    node_free(e, sizeof(Expr), in_arena);
+}
+
+void Expr::operator delete(void* ptr) {
+    node_free(ptr, sizeof(Expr), _arena_active());
 }
 
 Expr::Expr() {
     _type = ExprType::Empty;
+    _node_arena = _arena_active();
 }
 
 Expr Expr::var(char id) {
-    char* str = (char*)malloc(2);
-    str[0] = id;
-    str[1] = '\0';
-
-    Expr e;
-    e._type = ExprType::Var;
-    e._var = str;
-    return e;
+    return var(intern(std::string_view(&id, 1)));
 }
 
 Expr Expr::var(std::string_view id) {
+    return var(intern(id));
+}
+
+Expr Expr::var(Symbol id) {
     Expr e;
     e._type = ExprType::Var;
-    e._var = _cp_sv(id);
+    e._var = id;
     return e;
 }
 
 Expr Expr::fn(char id, const Expr& body) {
-    char* str = (char*)malloc(2);
-    str[0] = id;
-    str[1] = '\0';
-
-    Expr e;
-    e._type = ExprType::Fn;
-    e._fn.id = str;
-    e._fn.body = body.clone();
-    return e;
+    return fn(intern(std::string_view(&id, 1)), body);
 }
 
 Expr Expr::fn(std::string_view id, const Expr& body) {
+    return fn(intern(id), body);
+}
+
+Expr Expr::fn(Symbol id, const Expr& body) {
     Expr e;
     e._type = ExprType::Fn;
-    e._fn.id = _cp_sv(id);
+    e._fn.id = id;
     e._fn.body = body.clone();
     return e;
 }
@@ -62,120 +70,134 @@ Expr Expr::app(const Expr& lhs, const Expr& rhs) {
     return e;
 }
 
+Expr Expr::fn(char id, Expr&& body) {
+    return fn(intern(std::string_view(&id, 1)), std::move(body));
+}
+
+Expr Expr::fn(std::string_view id, Expr&& body) {
+    return fn(intern(id), std::move(body));
+}
+
+Expr Expr::fn(Symbol id, Expr&& body) {
+    Expr e;
+    e._type = ExprType::Fn;
+    e._fn.id = id;
+    e._fn.body = new Expr(std::move(body));
+    return e;
+}
+
+Expr Expr::app(Expr&& lhs, Expr&& rhs) {
+    Expr e;
+    e._type = ExprType::App;
+    e._app.lhs = new Expr(std::move(lhs));
+    e._app.rhs = new Expr(std::move(rhs));
+    return e;
+}
+
 Expr::Expr(const Expr& e) {
-    _type = e._type;
-    switch (_type) {
-        default:
-        case ExprType::Empty:
-            break;
-        case ExprType::Var:
-            _var = strdup(e._var);
-            break;
-        case ExprType::Fn:
-            _fn.id = strdup(e._fn.id);
-            _fn.body = new Expr(*e._fn.body);
-            break;
-        case ExprType::App:
-            _app.lhs = new Expr(*e._app.lhs);
-            _app.rhs = new Expr(*e._app.rhs);
-            break;
-    }
+    _node_arena = _arena_active();
+    _copy_from(e);
 }
 
 Expr::Expr(Expr&& e) {
-    memcpy(this, &e, sizeof(*this));
-    e._type = ExprType::Empty;
+    _node_arena = _arena_active();
+    _take_from(e);
 }
 
 Expr& Expr::operator=(const Expr& e) {
     this->~Expr();
-    _type = e._type;
-    switch (_type) {
-        default:
-        case ExprType::Empty:
-            break;
-        case ExprType::Var:
-            _var = strdup(e._var);
-            break;
-        case ExprType::Fn:
-            _fn.id = strdup(e._fn.id);
-            _fn.body = new Expr(*e._fn.body);
-            break;
-        case ExprType::App:
-            _app.lhs = new Expr(*e._app.lhs);
-            _app.rhs = new Expr(*e._app.rhs);
-            break;
-    }
-
+    _copy_from(e);
     return *this;
 }
 
 Expr& Expr::operator=(Expr&& e) {
     this->~Expr();
-    memcpy(this, &e, sizeof(*this));
-    e._type = ExprType::Empty;
+    _take_from(e);
     return *this;
 }
 
 Expr::~Expr() {
-    switch (_type) {
-        default:
-        case ExprType::Empty:
-            break;
-        case ExprType::Var:
-            free((void*)_var);
-            break;
-        case ExprType::Fn:
-            free((void*)_fn.id);
-            delete _fn.body;
-            break;
-        case ExprType::App:
-            delete _app.lhs;
-            delete _app.rhs;
-            break;
+    if (_type != ExprType::Fn && _type != ExprType::App) {
+        _type = ExprType::Empty;
+        return;
     }
+    //every node below is emptied before it is deleted, so a deep tree is freed
+    //off a work list rather than by one nested destructor call per level
+    std::vector<Expr*> nodes;
+    take_nodes(nodes);
+    for (Expr* node : nodes) delete node;
+}
+
+//children are allocated empty and filled in later from a work list, so deep
+//trees copy without recursing
+void Expr::_copy_from(const Expr& e) {
+    std::vector<std::pair<Expr*, const Expr*>> pending;
+    Expr* to = this;
+    const Expr* from = &e;
+    while (true) {
+        STAT_INC(expr_copies);
+        to->_type = from->_type;
+        switch (from->_type) {
+            default:
+            case ExprType::Empty:
+                break;
+            case ExprType::Var:
+                to->_var = from->_var;
+                break;
+            case ExprType::Fn:
+                to->_fn.id = from->_fn.id;
+                to->_fn.body = new Expr;
+                pending.push_back({ to->_fn.body, from->_fn.body });
+                break;
+            case ExprType::App:
+                to->_app.lhs = new Expr;
+                to->_app.rhs = new Expr;
+                pending.push_back({ to->_app.rhs, from->_app.rhs });
+                pending.push_back({ to->_app.lhs, from->_app.lhs });
+                break;
+        }
+        if (pending.empty()) break;
+        to = pending.back().first;
+        from = pending.back().second;
+        pending.pop_back();
+    }
+}
+
+//moves the contents only, the storage flag of this node is left untouched
+void Expr::_take_from(Expr& e) {
+    _type = e._type;
+    memcpy(&_app, &e._app, sizeof(_app));
+    e._type = ExprType::Empty;
 }
 
 Expr* Expr::clone() const {
     return new Expr(*this);
 }
 
+void Expr::take_nodes(std::vector<Expr*>& nodes) {
+    size_t next = nodes.size(); //first node whose children are still to take
+    Expr* node = this;
+    while (true) {
+        if (node->_type == ExprType::Fn) {
+            nodes.push_back(node->_fn.body);
+        } else if (node->_type == ExprType::App) {
+            nodes.push_back(node->_app.lhs);
+            nodes.push_back(node->_app.rhs);
+        }
+        node->_type = ExprType::Empty;
+        if (next == nodes.size()) break;
+        node = nodes[next++];
+    }
+}
+
 ExprType Expr::get_type() const {
     return _type;
 }
 
 std::string Expr::to_string() const {
-    std::stringstream ss;
-    _output(ss);
-    return ss.str();
-}
-
-struct _SubsEntry {
-    const char* id;
-    Expr* value;
-};
-
-void Expr::_output(std::stringstream& ss) const {
-    switch (_type) {
-        default:
-        case ExprType::Empty:
-            break;
-        case ExprType::Var:
-            ss << _var;
-            break;
-        case ExprType::Fn:
-            ss << '(' << '\\' << _var << '.';
-            _fn.body->_output(ss);
-            ss << ')';
-            break;
-        case ExprType::App:
-            ss << '(';
-            _app.lhs->_output(ss);
-            ss << ' ';
-            _app.rhs->_output(ss);
-            ss << ')';
-            break;
-    }
+    std::string out;
+    print_expr(*this, out);
+    return out;
 }
 
 void Expr::_internal_swap(Expr* inner) {
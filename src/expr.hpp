@@ -1,7 +1,11 @@
 #pragma once
 
+#include "symbol.hpp"
+
+#include <new>
 #include <string_view>
-#include <sstream>
+#include <string>
+#include <vector>
 
 enum class ExprType {
     Empty, //nothing allocated
@@ -14,27 +18,44 @@ struct Expr {
     Expr(); // does not initialize anything!
     static Expr var(char id);
     static Expr var(std::string_view id);
+    static Expr var(Symbol id);
     static Expr fn(char arg, const Expr& body);
     static Expr fn(std::string_view arg, const Expr& body);
+    static Expr fn(Symbol arg, const Expr& body);
     static Expr app(const Expr& lhs, const Expr& rhs);
+    // these take over the children of their arguments instead of copying them
+    static Expr fn(char arg, Expr&& body);
+    static Expr fn(std::string_view arg, Expr&& body);
+    static Expr fn(Symbol arg, Expr&& body);
+    static Expr app(Expr&& lhs, Expr&& rhs);
     Expr(const Expr& e);
     Expr(Expr&& e);
     Expr& operator=(const Expr& e);
     Expr& operator=(Expr&& e);
     ~Expr();
+
+    // nodes come from the current arena when one is active (see arena.hpp)
+    static void* operator new(size_t size);
+    static void operator delete(Expr* e, std::destroying_delete_t);
+    static void operator delete(void* ptr); //only used if a constructor throws
     
     Expr* clone() const;
     ExprType get_type() const;
-    std::string to_string() const;
+    std::string to_string() const; //see printer.hpp for limits and file output
+    // Empties this expression and appends every node below it to `nodes`,
+    // emptied as well, so a new tree can be built from them.
+    void take_nodes(std::vector<Expr*>& nodes);
 
     ExprType _type;
+    bool _node_arena; //this node's storage belongs to an arena
     union {
-        const char* _var;
-        struct { const char* id; Expr* body; } _fn;
+        Symbol _var;
+        struct { Symbol id; Expr* body; } _fn;
         struct { Expr* lhs; Expr* rhs; } _app;
     };
 
 private:
-    void _output(std::stringstream& ss) const;
+    void _copy_from(const Expr& e);
+    void _take_from(Expr& e);
     void _internal_swap(Expr* inner);
 };
\ No newline at end of file
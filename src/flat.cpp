@@ -0,0 +1,363 @@
+#include "flat.hpp"
+
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+using namespace std::string_view_literals;
+
+FlatNode FlatPool::var(Symbol id) {
+    tags.push_back(FlatTag::Var);
+    first.push_back(id);
+    second.push_back(0);
+    return (FlatNode)(tags.size() - 1);
+}
+
+FlatNode FlatPool::fn(Symbol arg, FlatNode body) {
+    tags.push_back(FlatTag::Fn);
+    first.push_back(arg);
+    second.push_back(body);
+    return (FlatNode)(tags.size() - 1);
+}
+
+FlatNode FlatPool::app(FlatNode lhs, FlatNode rhs) {
+    tags.push_back(FlatTag::App);
+    first.push_back(lhs);
+    second.push_back(rhs);
+    return (FlatNode)(tags.size() - 1);
+}
+
+void FlatPool::clear() {
+    tags.clear();
+    first.clear();
+    second.clear();
+}
+
+//children come before their parents, so one sweep down from `root` marks
+//everything under it
+static std::vector<bool> _reachable(const FlatPool& pool, FlatNode root) {
+    std::vector<bool> seen(root + 1, false);
+    seen[root] = true;
+    for (FlatNode i = root + 1; i-- > 0;) {
+        if (!seen[i]) continue;
+        switch (pool.tags[i]) {
+            case FlatTag::Var:
+                break;
+            case FlatTag::Fn:
+                seen[pool.second[i]] = true;
+                break;
+            case FlatTag::App:
+                seen[pool.first[i]] = true;
+                seen[pool.second[i]] = true;
+                break;
+        }
+    }
+    return seen;
+}
+
+FlatNode flat_from_expr(FlatPool& pool, const Expr& expr) {
+    size_t start = pool.size();
+    std::vector<std::pair<const Expr*, bool>> pending; //node, children added
+    std::vector<FlatNode> built;
+    pending.push_back({ &expr, false });
+    while (!pending.empty()) {
+        auto [e, ready] = pending.back();
+        pending.pop_back();
+        switch (e->_type) {
+            case ExprType::Var:
+                built.push_back(pool.var(e->_var));
+                break;
+            case ExprType::Fn:
+                if (ready) {
+                    built.back() = pool.fn(e->_fn.id, built.back());
+                } else {
+                    pending.push_back({ e, true });
+                    pending.push_back({ e->_fn.body, false });
+                }
+                break;
+            case ExprType::App:
+                if (ready) {
+                    FlatNode rhs = built.back();
+                    built.pop_back();
+                    built.back() = pool.app(built.back(), rhs);
+                } else {
+                    pending.push_back({ e, true });
+                    pending.push_back({ e->_app.rhs, false });
+                    pending.push_back({ e->_app.lhs, false });
+                }
+                break;
+            default:
+                pool.tags.resize(start);
+                pool.first.resize(start);
+                pool.second.resize(start);
+                return NO_FLAT_NODE;
+        }
+    }
+    return built.back();
+}
+
+Expr* flat_to_expr(const FlatPool& pool, FlatNode node) {
+    Expr* root = new Expr;
+    std::vector<std::pair<FlatNode, Expr*>> pending;
+    pending.push_back({ node, root });
+    while (!pending.empty()) {
+        auto [i, expr] = pending.back();
+        pending.pop_back();
+        switch (pool.tags[i]) {
+            case FlatTag::Var:
+                expr->_type = ExprType::Var;
+                expr->_var = pool.first[i];
+                break;
+            case FlatTag::Fn:
+                expr->_fn.id = pool.first[i];
+                expr->_fn.body = new Expr;
+                expr->_type = ExprType::Fn;
+                pending.push_back({ pool.second[i], expr->_fn.body });
+                break;
+            case FlatTag::App:
+                expr->_app.lhs = new Expr;
+                expr->_app.rhs = new Expr;
+                expr->_type = ExprType::App;
+                pending.push_back({ pool.second[i], expr->_app.rhs });
+                pending.push_back({ pool.first[i], expr->_app.lhs });
+                break;
+        }
+    }
+    return root;
+}
+
+size_t flat_printed_size(const FlatPool& pool, FlatNode node) {
+    std::vector<bool> seen = _reachable(pool, node);
+    std::vector<size_t> size(node + 1, 0);
+    for (FlatNode i = 0; i <= node; i++) {
+        if (!seen[i]) continue;
+        switch (pool.tags[i]) {
+            case FlatTag::Var:
+                size[i] = symbol_name(pool.first[i]).size();
+                break;
+            case FlatTag::Fn:
+                size[i] = 4 + symbol_name(pool.first[i]).size() + size[pool.second[i]]; //"(\" id "." body ")"
+                break;
+            case FlatTag::App:
+                size[i] = 3 + size[pool.first[i]] + size[pool.second[i]]; //"(" lhs " " rhs ")"
+                break;
+        }
+    }
+    return size[node];
+}
+
+//work items of flat_print past the node indices: text that closes a subtree
+static constexpr FlatNode _CLOSE = NO_FLAT_NODE - 1;
+static constexpr FlatNode _SPACE = NO_FLAT_NODE - 2;
+
+//one pass appending as it goes, which beats sizing the output first when the
+//nodes are this cheap to reach
+bool flat_print(const FlatPool& pool, FlatNode node, std::string& out, size_t limit) {
+    static constexpr std::string_view CUT_MARK = "..."sv;
+    size_t end = limit == NO_PRINT_LIMIT ? NO_PRINT_LIMIT : out.size() + limit;
+
+    std::vector<FlatNode> pending;
+    pending.push_back(node);
+    while (!pending.empty() && out.size() < end) {
+        FlatNode i = pending.back();
+        pending.pop_back();
+        if (i == _CLOSE) {
+            out += ')';
+            continue;
+        }
+        if (i == _SPACE) {
+            out += ' ';
+            continue;
+        }
+        switch (pool.tags[i]) {
+            case FlatTag::Var:
+                out += symbol_name(pool.first[i]);
+                break;
+            case FlatTag::Fn:
+                out += "(\\"sv;
+                out += symbol_name(pool.first[i]);
+                out += '.';
+                pending.push_back(_CLOSE);
+                pending.push_back(pool.second[i]);
+                break;
+            case FlatTag::App:
+                out += '(';
+                pending.push_back(_CLOSE);
+                pending.push_back(pool.second[i]);
+                pending.push_back(_SPACE);
+                pending.push_back(pool.first[i]);
+                break;
+        }
+    }
+    if (out.size() <= end && pending.empty()) return true;
+    out.resize(end);
+    out += CUT_MARK;
+    return false;
+}
+
+static uint64_t _mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 29;
+    return h;
+}
+
+uint64_t flat_hash(const FlatPool& pool, FlatNode node) {
+    std::vector<bool> seen = _reachable(pool, node);
+    std::vector<uint64_t> hash(node + 1, 0);
+    for (FlatNode i = 0; i <= node; i++) {
+        if (!seen[i]) continue;
+        uint64_t h = (uint64_t)pool.tags[i] + 1;
+        switch (pool.tags[i]) {
+            case FlatTag::Var:
+                hash[i] = _mix(h, pool.first[i]);
+                break;
+            case FlatTag::Fn:
+                hash[i] = _mix(_mix(h, pool.first[i]), hash[pool.second[i]]);
+                break;
+            case FlatTag::App:
+                hash[i] = _mix(_mix(h, hash[pool.first[i]]), hash[pool.second[i]]);
+                break;
+        }
+    }
+    return hash[node];
+}
+
+FlatNode flat_copy(const FlatPool& from, FlatNode node, FlatPool& to) {
+    std::vector<bool> seen = _reachable(from, node);
+    std::vector<FlatNode> moved(node + 1, NO_FLAT_NODE);
+    for (FlatNode i = 0; i <= node; i++) {
+        if (!seen[i]) continue;
+        switch (from.tags[i]) {
+            case FlatTag::Var:
+                moved[i] = to.var(from.first[i]);
+                break;
+            case FlatTag::Fn:
+                moved[i] = to.fn(from.first[i], moved[from.second[i]]);
+                break;
+            case FlatTag::App:
+                moved[i] = to.app(moved[from.first[i]], moved[from.second[i]]);
+                break;
+        }
+    }
+    return moved[node];
+}
+
+//what a name stands for while substituting. Bindings form chains from inner
+//to outer scopes; the innermost one for a name wins
+struct _FlatBinding {
+    Symbol id;
+    FlatNode value;     //NO_FLAT_NODE: bound by a binder in between, left alone
+    uint32_t outer;     //enclosing scope, UINT32_MAX at the top
+    bool renames;       //some binding in the chain renames a binder
+};
+
+FlatNode flat_substitute(FlatPool& pool, FlatNode body, Symbol id, FlatNode value) {
+    //which nodes of `body` have `id` free, and every name either side uses, for
+    //picking fresh ones
+    std::vector<bool> seen = _reachable(pool, body);
+    std::vector<bool> has_id(body + 1, false);
+    std::unordered_set<Symbol> used;
+    for (FlatNode i = 0; i <= body; i++) {
+        if (!seen[i]) continue;
+        if (pool.tags[i] != FlatTag::App) used.insert(pool.first[i]);
+        switch (pool.tags[i]) {
+            case FlatTag::Var:
+                has_id[i] = pool.first[i] == id;
+                break;
+            case FlatTag::Fn:
+                has_id[i] = pool.first[i] != id && has_id[pool.second[i]];
+                break;
+            case FlatTag::App:
+                has_id[i] = has_id[pool.first[i]] || has_id[pool.second[i]];
+                break;
+        }
+    }
+    //every name in `value`, a superset of the ones a binder must not capture
+    std::unordered_set<Symbol> captures;
+    std::vector<bool> in_value = _reachable(pool, value);
+    for (FlatNode i = 0; i <= value; i++) {
+        if (in_value[i] && pool.tags[i] != FlatTag::App) captures.insert(pool.first[i]);
+    }
+    used.insert(captures.begin(), captures.end());
+
+    std::vector<_FlatBinding> scopes;
+    scopes.push_back({ id, value, UINT32_MAX, false });
+    auto find = [&](uint32_t scope, Symbol name) {
+        for (; scope != UINT32_MAX; scope = scopes[scope].outer) {
+            if (scopes[scope].id == name) return scopes[scope].value;
+        }
+        return NO_FLAT_NODE;
+    };
+    auto fresh = [&](Symbol hint) {
+        std::string base(symbol_name(hint));
+        for (uint32_t n = 1;; n++) {
+            Symbol candidate = intern(base + std::to_string(n));
+            if (used.insert(candidate).second) return candidate;
+        }
+    };
+
+    struct Work {
+        FlatNode node;
+        uint32_t scope;
+        Symbol binder;  //Fn once its body is done: the binder's new name
+        bool ready;
+    };
+    std::vector<Work> pending;
+    std::vector<FlatNode> built;
+    pending.push_back({ body, 0, NO_SYMBOL, false });
+    while (!pending.empty()) {
+        Work w = pending.back();
+        pending.pop_back();
+        FlatNode i = w.node;
+        bool renames = scopes[w.scope].renames;
+        if (!w.ready && !renames && (!has_id[i] || find(w.scope, id) == NO_FLAT_NODE)) {
+            built.push_back(i);
+            continue;
+        }
+
+        switch (pool.tags[i]) {
+            case FlatTag::Var: {
+                FlatNode to = find(w.scope, pool.first[i]);
+                built.push_back(to == NO_FLAT_NODE ? i : to);
+                break;
+            }
+            case FlatTag::Fn: {
+                if (w.ready) {
+                    FlatNode b = built.back();
+                    bool same = b == pool.second[i] && w.binder == pool.first[i];
+                    built.back() = same ? i : pool.fn(w.binder, b);
+                    break;
+                }
+                Symbol name = pool.first[i];
+                Symbol binder = name;
+                FlatNode to = NO_FLAT_NODE;
+                if (captures.count(name) && has_id[pool.second[i]] && find(w.scope, id) != NO_FLAT_NODE) {
+                    binder = fresh(name);
+                    to = pool.var(binder);
+                    renames = true;
+                }
+                scopes.push_back({ name, to, w.scope, renames });
+                pending.push_back({ i, w.scope, binder, true });
+                pending.push_back({ pool.second[i], (uint32_t)scopes.size() - 1, NO_SYMBOL, false });
+                break;
+            }
+            case FlatTag::App: {
+                if (w.ready) {
+                    FlatNode rhs = built.back();
+                    built.pop_back();
+                    FlatNode lhs = built.back();
+                    bool same = lhs == pool.first[i] && rhs == pool.second[i];
+                    built.back() = same ? i : pool.app(lhs, rhs);
+                    break;
+                }
+                pending.push_back({ i, w.scope, NO_SYMBOL, true });
+                pending.push_back({ pool.second[i], w.scope, NO_SYMBOL, false });
+                pending.push_back({ pool.first[i], w.scope, NO_SYMBOL, false });
+                break;
+            }
+        }
+    }
+    return built.back();
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "expr.hpp"
+#include "printer.hpp"
+#include "symbol.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Named terms stored flat: the nodes of any number of terms live in one pool,
+// addressed by 32-bit indices, with their tags and fields in parallel arrays.
+// A node only refers to nodes added before it and never changes once added,
+// so subtrees can be shared freely within a pool, and the operations below
+// sweep a few dense arrays instead of chasing Expr pointers around the heap.
+enum class FlatTag : uint8_t {
+    Var,
+    Fn,
+    App
+};
+
+using FlatNode = uint32_t;
+constexpr FlatNode NO_FLAT_NODE = UINT32_MAX;
+
+struct FlatPool {
+    std::vector<FlatTag> tags;
+    std::vector<uint32_t> first;  //Var: the name, Fn: the binder's name, App: lhs
+    std::vector<uint32_t> second; //Fn: body, App: rhs
+
+    FlatNode var(Symbol id);
+    FlatNode fn(Symbol arg, FlatNode body);
+    FlatNode app(FlatNode lhs, FlatNode rhs);
+
+    size_t size() const { return tags.size(); }
+    void clear();
+};
+
+// Adds `expr` to the pool; NO_FLAT_NODE, with the pool left as it was, if the
+// expression is corrupted.
+FlatNode flat_from_expr(FlatPool& pool, const Expr& expr);
+// Builds the tree under `node` as an Expr, with a copy of a shared subtree
+// wherever it occurs.
+Expr* flat_to_expr(const FlatPool& pool, FlatNode node);
+
+// Same output as the Expr printers in printer.hpp.
+size_t flat_printed_size(const FlatPool& pool, FlatNode node);
+bool flat_print(const FlatPool& pool, FlatNode node, std::string& out, size_t limit = NO_PRINT_LIMIT);
+
+// Structural hash: trees that print the same hash the same, however they are
+// shared.
+uint64_t flat_hash(const FlatPool& pool, FlatNode node);
+
+// Adds the tree under `node` in `from` to `to`, keeping its sharing.
+FlatNode flat_copy(const FlatPool& from, FlatNode node, FlatPool& to);
+
+// Replaces the free occurrences of `id` in `body` by `value`, both in `pool`,
+// renaming binders that would capture a variable of `value`. The result
+// shares every part of `body` that does not change, and `value` itself at
+// every occurrence.
+FlatNode flat_substitute(FlatPool& pool, FlatNode body, Symbol id, FlatNode value);
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// Open-addressing hash map from strings to V with linear probing. Lookups take
+// a std::string_view, so const char* and std::string keys never allocate.
+// The map does not copy key text: the caller keeps it alive for as long as
+// the entry exists (interned symbol names are the usual keys).
+template<typename V>
+struct StringMap {
+    StringMap() {}
+    StringMap(const StringMap&) = delete;
+    StringMap& operator=(const StringMap&) = delete;
+
+    StringMap(StringMap&& other) {
+        *this = std::move(other);
+    }
+
+    StringMap& operator=(StringMap&& other) {
+        std::swap(_slots, other._slots);
+        std::swap(_capacity, other._capacity);
+        std::swap(_count, other._count);
+        return *this;
+    }
+
+    ~StringMap() {
+        clear();
+        free(_slots);
+    }
+
+    V* find(std::string_view key) {
+        if (_count == 0) return nullptr;
+        uint32_t hash = _hash(key);
+        size_t mask = _capacity - 1;
+        for (size_t i = hash & mask; _slots[i].hash; i = (i + 1) & mask) {
+            if (_slots[i].hash == hash && _slots[i].key == key) return &_slots[i].value;
+        }
+        return nullptr;
+    }
+
+    const V* find(std::string_view key) const {
+        return const_cast<StringMap*>(this)->find(key);
+    }
+
+    // Returns the existing value for key, or inserts `value` under it.
+    V& insert(std::string_view key, V value) {
+        if ((_count + 1) * 4 > _capacity * 3) _grow();
+        uint32_t hash = _hash(key);
+        size_t mask = _capacity - 1;
+        size_t i = hash & mask;
+        for (; _slots[i].hash; i = (i + 1) & mask) {
+            if (_slots[i].hash == hash && _slots[i].key == key) return _slots[i].value;
+        }
+        _slots[i].hash = hash;
+        _slots[i].key = key;
+        new (&_slots[i].value) V(std::move(value));
+        _count++;
+        return _slots[i].value;
+    }
+
+    bool erase(std::string_view key) {
+        if (_count == 0) return false;
+        uint32_t hash = _hash(key);
+        size_t mask = _capacity - 1;
+        size_t i = hash & mask;
+        while (true) {
+            if (!_slots[i].hash) return false;
+            if (_slots[i].hash == hash && _slots[i].key == key) break;
+            i = (i + 1) & mask;
+        }
+        _slots[i].value.~V();
+
+        //backward-shift deletion keeps probe sequences intact without tombstones
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (!_slots[j].hash) break;
+            size_t home = _slots[j].hash & mask;
+            bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+            if (stays) continue;
+            _slots[i].hash = _slots[j].hash;
+            _slots[i].key = _slots[j].key;
+            new (&_slots[i].value) V(std::move(_slots[j].value));
+            _slots[j].value.~V();
+            i = j;
+        }
+        _slots[i].hash = 0;
+        _count--;
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < _capacity; i++) {
+            if (!_slots[i].hash) continue;
+            _slots[i].value.~V();
+            _slots[i].hash = 0;
+        }
+        _count = 0;
+    }
+
+    size_t size() const {
+        return _count;
+    }
+
+    template<typename F>
+    void for_each(F&& fn) {
+        for (size_t i = 0; i < _capacity; i++) {
+            if (_slots[i].hash) fn(_slots[i].key, _slots[i].value);
+        }
+    }
+
+private:
+    struct _Slot {
+        uint32_t hash; //0 marks an empty slot
+        std::string_view key;
+        V value;
+    };
+
+    static uint32_t _hash(std::string_view key) {
+        uint32_t h = (uint32_t)std::hash<std::string_view>()(key);
+        return h ? h : 1;
+    }
+
+    void _grow() {
+        size_t old_capacity = _capacity;
+        _Slot* old_slots = _slots;
+        size_t capacity = _capacity ? _capacity * 2 : 64;
+        _Slot* slots = (_Slot*)calloc(capacity, sizeof(_Slot));
+        if (!slots) throw std::bad_alloc();
+        _capacity = capacity;
+        _slots = slots;
+        size_t mask = _capacity - 1;
+        for (size_t i = 0; i < old_capacity; i++) {
+            _Slot& slot = old_slots[i];
+            if (!slot.hash) continue;
+            size_t j = slot.hash & mask;
+            while (_slots[j].hash) j = (j + 1) & mask;
+            _slots[j].hash = slot.hash;
+            _slots[j].key = slot.key;
+            new (&_slots[j].value) V(std::move(slot.value));
+            slot.value.~V();
+        }
+        free(old_slots);
+    }
+
+    _Slot* _slots = nullptr;
+    size_t _capacity = 0;
+    size_t _count = 0;
+};
\ No newline at end of file
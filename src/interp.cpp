@@ -1,484 +1,873 @@
 #include "interp.hpp"
 #include "expr.hpp"
+#include "arena.hpp"
+#include "bytecode.hpp"
+#include "symbol.hpp"
+#include "term.hpp"
+#include "eval.hpp"
+#include "machine.hpp"
+#include "native.hpp"
+#include "net.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "hashmap.hpp"
 
-#include <cctype>
-#include <cstdio>
 #include <memory>
+#include <new>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <cstring>
+#include <deque>
+#include <unordered_set>
+
+// Definitions never move once created, so the index of a name's slot is a
+// stable handle: clearing a variable empties its slot but keeps the handle,
+// and Global terms cache it to skip hashing on later references.
+//
+// Each definition also caches the normal form of its term the first time it
+// is referenced, and the bytecode of that the first time the VM runs it.
+// `deps` and `dependents` link definitions to the globals their terms
+// mention, so reassigning a name drops only the caches built on it.
+struct _VariableDef {
+    Symbol id;
+    VarHandle handle;
+    TermPtr term; //shared with every other holder of the same term, null if unassigned
+    TermPtr normal; //cached normal form of term
+    bool normalizing = false; //normal form being computed, a reference now is recursion
+    bool no_normal = false; //normalizing failed or ran out of steps, use term as is
+    std::unique_ptr<Bytecode> code[2]; //what the normal form (or term) compiles to, strict and lazy, once the VM asks
+    std::vector<VarHandle> deps;
+    std::vector<VarHandle> dependents;
+    std::unique_ptr<Expr> value; //named form, only built if get_variable asks
+    const _VariableDef* inherited = nullptr; //the prelude's definition, used while this one is unassigned
+};
+
+struct _Environment {
+    std::deque<_VariableDef> variables;
+    StringMap<VarHandle> index;
+};
+
+// Its terms are immortal nodes of `factory`, and the Global nodes among them
+// cache their handles in `env`, so lookups never write.
+struct Prelude {
+    std::shared_ptr<TermFactory> factory;
+    _Environment env;
+};
 
-bool is_id_char(char c) {
-    switch (c) {
-        case '\\':
-        case '.':
-            return false;
-        default:
-            return true;
+//step budget for computing a cached normal form, a definition that needs more
+//is evaluated from its term on every reference instead
+static constexpr uint64_t _NORMALIZE_STEPS = 1 << 18;
+
+struct Session::_State {
+    std::shared_ptr<TermFactory> factory; //null for the process-wide factory
+    std::shared_ptr<const Prelude> prelude;
+    _Environment env;
+    std::string error;
+    bool has_error = false;
+
+    bool fail(std::string text) {
+        error = std::move(text);
+        has_error = true;
+        return false;
     }
 
-    //if (c >= 'a' && c <= 'z') return true;
-    //if (c >= 'A' && c <= 'Z') return true;
-    //if (c == '_') return true;
+    _VariableDef* find_var(std::string_view id);
+    _VariableDef* get_or_add_var(Symbol id);
+    void invalidate(_VariableDef* def);
+    void set_definition(_VariableDef* def, Term* term);
+    const Term* definition(_VariableDef& def);
+    Expr* value(_VariableDef* def);
+    void prepare_globals(const Term* term);
+    TermPtr normalize(const Expr& expr, const ReduceOptions& options, Arena* target, Expr*& named);
+    Term* reduce(const Term* term, const ReduceOptions& options, EvalContext& ctx);
+
+    static const Term* lookup(void* state, const Term* global);
+    static const Term* lookup_written(void* state, const Term* global);
+    static const Bytecode* code(void* state, const Term* global, bool lazy);
+};
+
+//the term a definition was given, its own or the prelude's
+static const Term* _written_term(const _VariableDef& def) {
+    if (def.term) return def.term.get();
+    return def.inherited ? def.inherited->term.get() : nullptr;
 }
 
-enum Token {
-    TOKEN_ID,
-    TOKEN_ASSIGN,
-    TOKEN_FN_LAMBDA,
-    TOKEN_FN_PERIOD,
-    TOKEN_PARENL,
-    TOKEN_PARENR,
-    TOKEN_EOL,
-};
+_VariableDef* Session::_State::find_var(std::string_view id) {
+    STAT_INC(index_probes);
+    VarHandle* handle = env.index.find(id);
+    _VariableDef* def = nullptr;
+    if (handle) {
+        def = &env.variables[*handle];
+    } else if (prelude && prelude->env.index.find(id)) {
+        def = get_or_add_var(intern(id));
+    }
+    return def && _written_term(*def) ? def : nullptr;
+}
+
+_VariableDef* Session::_State::get_or_add_var(Symbol id) {
+    VarHandle handle = (VarHandle)env.variables.size();
+    VarHandle found = env.index.insert(symbol_name(id), handle);
+    if (found == handle) {
+        _VariableDef& def = env.variables.emplace_back();
+        def.id = id;
+        def.handle = handle;
+        const VarHandle* base = prelude ? prelude->env.index.find(symbol_name(id)) : nullptr;
+        if (base) def.inherited = &prelude->env.variables[*base];
+    }
+    return &env.variables[found];
+}
 
-std::vector<Token> t_tokens;
-std::vector<std::string> t_ids;
-std::vector<int> t_columns;
-std::string_view t_expression_string;
-bool t_concat;
-const char* t_current_char;
+//drops the cached normal form of `def` and of everything that depends on it
+void Session::_State::invalidate(_VariableDef* def) {
+    std::vector<bool> seen(env.variables.size(), false);
+    std::vector<VarHandle> pending;
+    pending.push_back(def->handle);
+    seen[def->handle] = true;
+    while (!pending.empty()) {
+        _VariableDef& d = env.variables[pending.back()];
+        pending.pop_back();
+        d.normal.reset();
+        d.no_normal = false;
+        d.code[0].reset();
+        d.code[1].reset();
+        for (VarHandle h : d.dependents) {
+            if (seen[h]) continue;
+            seen[h] = true;
+            pending.push_back(h);
+        }
+    }
+}
 
-size_t p_token;
+void Session::_State::set_definition(_VariableDef* def, Term* term) {
+    invalidate(def);
+    for (VarHandle h : def->deps) {
+        std::vector<VarHandle>& list = env.variables[h].dependents;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] != def->handle) continue;
+            list[i] = list.back();
+            list.pop_back();
+            break;
+        }
+    }
+    def->deps.clear();
+
+    def->term.reset(term);
+    def->value.reset();
+    if (!term) return;
+
+    std::vector<Symbol> globals;
+    term_globals(term, globals);
+    for (Symbol sym : globals) {
+        _VariableDef* dep = get_or_add_var(sym);
+        def->deps.push_back(dep->handle);
+        dep->dependents.push_back(def->handle);
+    }
+}
 
-std::string error;
-bool has_error = false;
+const Term* Session::_State::definition(_VariableDef& def) {
+    if (!def.term) {
+        const _VariableDef* base = def.inherited;
+        if (!base || !base->term) return nullptr;
+        return base->normal ? base->normal.get() : base->term.get();
+    }
+    if (def.normal) return def.normal.get();
+    if (def.no_normal || def.normalizing) return def.term.get();
+
+    //first reference since the definition (or one it uses) changed. This runs on
+    //the machine and in an arena of its own, so a definition without a normal
+    //form costs its step budget once and leaves nothing behind
+    Arena scratch;
+    ArenaScope scope(&scratch);
+    EvalContext ctx;
+    ctx.lookup = lookup;
+    ctx.env = this;
+    ctx.max_steps = _NORMALIZE_STEPS;
+    STAT_INC(normalizations);
+    Symbol caller = stat_centre();
+    stat_set_centre(def.id);
+
+    def.normalizing = true;
+    def.normal.reset(machine_normalize_term(def.term.get(), ctx));
+    def.normalizing = false;
+    stat_set_centre(caller);
+    def.no_normal = !def.normal;
+    return def.normal ? def.normal.get() : def.term.get();
+}
 
-static std::string_view token_to_string(Token t) {
-    using namespace std::string_view_literals;
+//a frozen Global node belongs to the prelude, whose handles were all cached
+//when it was frozen
+static const Term* _prelude_lookup(const Prelude& prelude, const Term* global) {
+    VarHandle handle = global->global.handle;
+    if (handle == NO_VAR_HANDLE) return nullptr;
+    const _VariableDef& def = prelude.env.variables[handle];
+    if (!def.term) return nullptr;
+    return def.normal ? def.normal.get() : def.term.get();
+}
 
-    switch (t) {
-        case TOKEN_ID: return "ID"sv;
-        case TOKEN_ASSIGN: return "assign operator"sv;
-        case TOKEN_FN_LAMBDA: return "lambda operator"sv;
-        case TOKEN_FN_PERIOD: return "lambda body"sv;
-        case TOKEN_PARENL: return "open parenthesis"sv;
-        case TOKEN_PARENR: return "close parenthesis"sv;
-        case TOKEN_EOL: return "EOL"sv;
+const Term* Session::_State::lookup(void* state, const Term* global) {
+    _State& s = *(_State*)state;
+    STAT_INC(lookups);
+    if (term_immortal(global)) return s.prelude ? _prelude_lookup(*s.prelude, global) : nullptr;
+
+    VarHandle handle = global->global.handle;
+    if (handle == NO_VAR_HANDLE) {
+        STAT_INC(index_probes);
+        std::string_view name = symbol_name(global->global.id);
+        VarHandle* found = s.env.index.find(name);
+        if (found) {
+            handle = *found;
+        } else if (s.prelude && s.prelude->env.index.find(name)) {
+            handle = s.get_or_add_var(global->global.id)->handle;
+        } else {
+            return nullptr;
+        }
+        const_cast<Term*>(global)->global.handle = handle;
     }
+    return s.definition(s.env.variables[handle]);
+}
 
-    return "?"sv;
+//only asked after lookup, which cached the handle
+//the prelude compiled its definitions when it was frozen, a session compiles
+//its own on first use
+const Bytecode* Session::_State::code(void* state, const Term* global, bool lazy) {
+    _State& s = *(_State*)state;
+    const Term* def = lookup(state, global);
+    if (!def) return nullptr;
+    if (term_immortal(global)) return s.prelude->env.variables[global->global.handle].code[lazy].get();
+
+    _VariableDef& d = s.env.variables[global->global.handle];
+    if (!d.term) return d.inherited->code[lazy].get();
+    if (!d.code[lazy]) d.code[lazy].reset(bytecode_compile(def, lazy));
+    return d.code[lazy].get();
 }
 
-static char* char_str(char x) {
-    char* buf = new char[2];
-    buf[0] = x;
-    buf[1] = '\0';
-    return buf;
+const Term* Session::_State::lookup_written(void* state, const Term* global) {
+    _State& s = *(_State*)state;
+    VarHandle handle = global->global.handle;
+    if (handle == NO_VAR_HANDLE) return nullptr;
+    if (term_immortal(global)) return s.prelude ? s.prelude->env.variables[handle].term.get() : nullptr;
+    return _written_term(s.env.variables[handle]);
 }
 
-static void push_token(Token token) {
-    t_tokens.push_back(token);
-    t_ids.emplace_back();
-    t_columns.push_back(t_current_char - t_expression_string.begin() + 1);
-    t_concat = false;
+Expr* Session::_State::value(_VariableDef* def) {
+    if (!def->value) {
+        //definitions outlive the evaluation that asked for them, keep them off the arena
+        ArenaScope heap(nullptr);
+        def->value.reset(term_to_expr(_written_term(*def)));
+    }
+
+    has_error = false;
+    return def->value.get();
 }
 
-static void push_id_token(char c) {
-    if (t_concat && !t_tokens.empty() && t_tokens.back() == TOKEN_ID) {
-        t_ids.back() += c;
-        return;
+//the parallel backend looks definitions up from several threads at once, so
+//every one it can reach is resolved and normalized up front and the lookups
+//it makes afterwards only read
+void Session::_State::prepare_globals(const Term* term) {
+    std::vector<Symbol> pending;
+    term_globals(term, pending);
+    std::unordered_set<Symbol> seen(pending.begin(), pending.end());
+    while (!pending.empty()) {
+        TermPtr global(term_global(pending.back()));
+        pending.pop_back();
+        const Term* def = lookup(this, global.get());
+        if (!def || def != env.variables[global->global.handle].term.get()) continue;
+
+        //no normal form, so evaluating it reaches its raw dependencies
+        std::vector<Symbol> deps;
+        term_globals(def, deps);
+        for (Symbol dep : deps) {
+            if (seen.insert(dep).second) pending.push_back(dep);
+        }
     }
+}
 
-    t_tokens.push_back(TOKEN_ID);
-    t_ids.emplace_back() = c;
-    t_columns.push_back(t_current_char - t_expression_string.begin() + 1);
-    t_concat = true;
+Session::Session(std::shared_ptr<const Prelude> prelude) : _state(new _State) {
+    _state->factory.reset(new TermFactory);
+    _state->prelude = std::move(prelude);
 }
 
-std::string get_error_text() {
-    if (!has_error) return {};
-    return error;
+Session::~Session() {
+    //the definitions release their terms into the session's factory
+    TermScope scope(_state->factory.get());
+    _state.reset();
 }
 
-static void token_err(const std::string& text) {
-    using namespace std::string_literals;
-    error = "column "s + std::to_string(t_current_char - t_expression_string.begin()) + ": "s + text;
-    has_error = true;
+Session& default_session() {
+    //never destroyed, like the process-wide factory it builds in
+    static Session& session = *[] {
+        Session* s = new Session;
+        s->_state->factory.reset();
+        return s;
+    }();
+    return session;
 }
 
-static void parse_err(const std::string& text) {
-    using namespace std::string_literals;
-    error = "column "s + std::to_string(t_columns[p_token]) + ": "s + text;
-    has_error = true;
+std::string Session::get_error_text() const {
+    if (!_state->has_error) return {};
+    return _state->error;
 }
 
-static void parse_bad_token_err() {
-    using namespace std::string_literals;
-    error = "column "s + std::to_string(t_columns[p_token]) + ": unexpected "s + std::string(token_to_string(t_tokens[p_token]));
-    has_error = true;
+std::optional<Instruction> Session::interpret_expression(std::string_view expr_str) {
+    STAT_TIME(parse_ns);
+    Parser parser(expr_str);
+    std::optional<Instruction> inst = parser.parse_instruction();
+    _state->has_error = !inst;
+    if (!inst) _state->error = parser.error();
+    return inst;
+}
+
+std::optional<Expr> Session::parse_expression(std::string_view expr_str) {
+    STAT_TIME(parse_ns);
+    Parser parser(expr_str);
+    std::unique_ptr<Expr> expr = parser.parse_expression();
+    _state->has_error = !expr;
+    if (!expr) {
+        _state->error = parser.error();
+        return std::nullopt;
+    }
+
+    auto op = std::make_optional<Expr>();
+    *op = std::move(*expr);
+    return op;
+}
+
+void Session::clear_variables() {
+    TermScope scope(_state->factory.get());
+    for (_VariableDef& def : _state->env.variables) {
+        def.term.reset();
+        def.normal.reset();
+        def.no_normal = false;
+        def.code[0].reset();
+        def.code[1].reset();
+        def.deps.clear();
+        def.dependents.clear();
+        def.value.reset();
+    }
 }
 
-static void tokenize() {
+bool Session::clear_variable(const char* id) {
     using namespace std::string_literals;
+    TermScope scope(_state->factory.get());
+    _VariableDef* def = _state->find_var(id);
+    if (!def) return _state->fail("variable "s + id + " is not assigned");
+    if (!def->term) return _state->fail("variable "s + id + " belongs to the prelude");
 
-    t_current_char = t_expression_string.begin();
-    t_tokens.clear();
-    t_ids.clear();
-    t_columns.clear();
-    t_concat = false;
-    has_error = false;
+    _state->set_definition(def, nullptr);
+    _state->has_error = false;
+    return true;
+}
 
-    while (true) {
-        if (t_current_char == t_expression_string.end()) break;
-        char c = *t_current_char;
-        
-        if (std::isspace(c)) { t_concat = false; }
-        else if (c == '=') { push_token(TOKEN_ASSIGN); }
-        else if (c == '(') { push_token(TOKEN_PARENL); }
-        else if (c == ')') { push_token(TOKEN_PARENR); }
-        else if (c == '\\') { push_token(TOKEN_FN_LAMBDA); }
-        else if (c == '.') { push_token(TOKEN_FN_PERIOD); }
-        //else if (is_id_char(c)) { push_token(TOKEN_ID, c); }
-        //else { token_err("unexpected character \""s + c + '\"'); return; }
-        else { push_id_token(c); }
+bool Session::set_variable(const char* id, const Expr& expr) {
+    TermScope scope(_state->factory.get());
+    Term* term = compile_expr(expr);
+    if (!term) return _state->fail("corrupted expression passed to function");
 
-        t_current_char++;
-    }
-    push_token(TOKEN_EOL);
+    _state->set_definition(_state->get_or_add_var(intern(id)), term);
+    _state->has_error = false;
+    return true;
 }
 
-static std::unique_ptr<Expr> parse_expr();
+bool Session::set_variable(const char* id, const char* raw_expr) {
+    std::optional<Expr> expr = parse_expression(raw_expr);
+    if (!expr) return false;
+    return set_variable(id, *expr);
+}
 
-static std::unique_ptr<Expr> parse_expr_id() {
-    const std::string& id = t_ids[p_token];
-    p_token++;
-    std::unique_ptr<Expr> new_expr(new Expr);
-    new_expr->_type = ExprType::Var;
-    new_expr->_var = strdup(id.c_str());
-    return new_expr;
+VarHandle Session::resolve_variable(const char* id) {
+    STAT_INC(index_probes);
+    VarHandle* handle = _state->env.index.find(id);
+    if (handle) return *handle;
+    _VariableDef* def = _state->find_var(id); //adds a slot for a prelude name
+    return def ? def->handle : NO_VAR_HANDLE;
 }
 
-static std::unique_ptr<Expr> parse_expr_lambda() {
-    if (t_tokens[p_token] != TOKEN_FN_LAMBDA) {
-        parse_bad_token_err();
+Expr* Session::get_variable(const char* id) {
+    using namespace std::string_literals;
+    TermScope scope(_state->factory.get());
+    _VariableDef* def = _state->find_var(id);
+    if (!def) {
+        _state->fail("variable "s + id + " is not assigned");
         return nullptr;
     }
-    p_token++;
-    if (t_tokens[p_token] != TOKEN_ID) {
-        parse_bad_token_err();
+
+    return _state->value(def);
+}
+
+Expr* Session::get_variable(VarHandle handle) {
+    using namespace std::string_literals;
+    TermScope scope(_state->factory.get());
+    if (handle >= _state->env.variables.size() || !_written_term(_state->env.variables[handle])) {
+        _state->fail("variable handle "s + std::to_string(handle) + " is not assigned");
         return nullptr;
     }
-    std::string& id = t_ids[p_token];
-    p_token++;
-    if (t_tokens[p_token] != TOKEN_FN_PERIOD) {
-        parse_bad_token_err();
-        return nullptr;
+
+    return _state->value(&_state->env.variables[handle]);
+}
+
+//hands this thread's counts over to the totals once a reduction is done,
+//whichever way it ends
+struct _FlushStats {
+    _FlushStats() {
+        STAT_INC(queries);
+        stat_set_centre(NO_SYMBOL);
     }
-    p_token++;
-    auto expr = parse_expr();
-    if (!expr) return nullptr;
+    ~_FlushStats() { stats_flush(); }
+};
+
+//the limits and evaluation order `options` ask for
+static void _limit(EvalContext& ctx, const ReduceOptions& options) {
+    ctx.lazy = options.lazy || options.strategy == Strategy::Normal;
+    ctx.max_steps = options.max_steps;
+    ctx.max_bytes = options.max_bytes;
+    ctx.cancelled = options.cancelled;
+    if (options.timeout_ms) ctx.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.timeout_ms);
+}
 
-    std::unique_ptr<Expr> new_expr(new Expr);
-    new_expr->_type = ExprType::Fn;
-    new_expr->_fn.id = strdup(id.c_str());
-    new_expr->_fn.body = expr.release();
-    return new_expr;
+//runs every backend but the parallel one, which hands back no term
+Term* Session::_State::reduce(const Term* term, const ReduceOptions& options, EvalContext& ctx) {
+    switch (options.backend) {
+        case Backend::Recursive: {
+            if (options.strategy == Strategy::Whnf) return whnf_term(term, ctx);
+            if (options.strategy == Strategy::Hnf) return hnf_term(term, ctx);
+            std::optional<Native> native;
+            if (options.native) {
+                native.emplace(lookup_written, this);
+                ctx.native = &*native;
+            }
+            Term* normal = normalize_term(term, ctx);
+            ctx.native = nullptr;
+            return normal;
+        }
+        case Backend::Machine:
+            return machine_normalize_term(term, ctx);
+        case Backend::Net:
+            return net_normalize_term(term, ctx);
+        case Backend::Vm:
+            ctx.code = code;
+            return vm_normalize_term(term, ctx);
+        case Backend::Parallel:
+            break;
+    }
+    return nullptr;
 }
 
-static std::unique_ptr<Expr> parse_expr_paren() {
-    if (t_tokens[p_token] != TOKEN_PARENL) {
-        parse_bad_token_err();
+//compiles and normalizes `expr` in the current arena. The parallel backend
+//reads back on the way, so it hands over the named result, built in `target`,
+//and no term
+TermPtr Session::_State::normalize(const Expr& expr, const ReduceOptions& options, Arena* target, Expr*& named) {
+    named = nullptr;
+    if (const char* error = options_error(options)) {
+        fail(error);
+        return nullptr;
+    }
+    TermPtr term;
+    {
+        STAT_TIME(compile_ns);
+        term.reset(compile_expr(expr));
+    }
+    if (!term) {
+        fail("corrupted expression passed to function");
         return nullptr;
     }
-    p_token++;
-    auto expr = parse_expr();
-    if (!expr) return nullptr;
 
-    if (t_tokens[p_token] != TOKEN_PARENR) {
-        parse_bad_token_err();
+    EvalContext ctx;
+    _limit(ctx, options);
+    ctx.lookup = lookup;
+    ctx.env = this;
+    ctx.start(Arena::current());
+
+    if (options.backend == Backend::Parallel) {
+        prepare_globals(term.get());
+        ParallelOptions parallel;
+        parallel.threads = options.threads;
+        parallel.threshold = options.parallel_threshold;
+
+        //reads back to named form on the way, so it is all evaluation time
+        STAT_TIME(eval_ns);
+        ArenaScope out(target);
+        named = parallel_normalize(term.get(), ctx, parallel);
+        if (!named) fail(ctx.error);
+        has_error = !named;
         return nullptr;
     }
-    p_token++;
 
-    return expr;
+    TermPtr normal;
+    {
+        STAT_TIME(eval_ns);
+        normal.reset(reduce(term.get(), options, ctx));
+    }
+    if (!normal) {
+        fail(ctx.error);
+        return nullptr;
+    }
+    has_error = false;
+    return normal;
 }
 
-static std::unique_ptr<Expr> parse_expr() {
-    std::unique_ptr<Expr> expr;
+Expr* Session::reduce_expression(Expr* expr, const ReduceOptions& options) {
+    _FlushStats stats;
+    TermScope terms(_state->factory.get());
+
+    //the result goes wherever the caller allocates, everything else lives and
+    //dies with this evaluation's own arena
+    Arena* target = Arena::current();
+    Arena scratch;
+    ArenaScope scope(&scratch);
+
+    //running out of memory anywhere in here fails the query, whatever terms it
+    //had in flight stay behind
+    try {
+        Expr* named;
+        TermPtr normal = _state->normalize(*expr, options, target, named);
+        if (!normal) return named;
+
+        ArenaScope out(target);
+        STAT_TIME(read_back_ns);
+        return term_to_expr(normal.get());
+    } catch (const std::bad_alloc&) {
+        _state->fail("out of memory");
+        return nullptr;
+    }
+}
 
-    while (true) {
-        std::unique_ptr<Expr> next;
+bool Session::reduce_in_place(Expr&& expr, const ReduceOptions& options) {
+    _FlushStats stats;
+    TermScope terms(_state->factory.get());
 
-        switch (t_tokens[p_token]) {
-            case TOKEN_ID:              next = parse_expr_id(); break;
-            case TOKEN_FN_LAMBDA:       next = parse_expr_lambda(); break;
-            case TOKEN_PARENL:          next = parse_expr_paren(); break;
-            default:                    goto PARSE_EXPR_EOL;
-        }
+    Arena* target = Arena::current();
+    Arena scratch;
+    ArenaScope scope(&scratch);
 
-        if (!next) return nullptr;
+    Expr* named;
+    TermPtr normal;
+    try {
+        normal = _state->normalize(expr, options, target, named);
+    } catch (const std::bad_alloc&) {
+        return _state->fail("out of memory");
+    }
+    if (!normal && !named) return false;
+
+    //the query is no longer needed once normalized, so the result is built in
+    //its nodes, and only the part of it that outgrows them is allocated
+    ArenaScope out(target);
+    if (named) {
+        expr = std::move(*named);
+        delete named;
+        return true;
+    }
+    STAT_TIME(read_back_ns);
+    std::vector<Expr*> spare;
+    expr.take_nodes(spare);
+    try {
+        term_to_expr(normal.get(), expr, spare);
+    } catch (const std::bad_alloc&) {
+        //the part read back so far goes with the nodes it had not used yet
+        expr.take_nodes(spare);
+        for (Expr* node : spare) delete node;
+        return _state->fail("out of memory");
+    }
+    return true;
+}
 
-        if (!expr) {
-            expr = std::move(next);
-        } else {
-            std::unique_ptr<Expr> new_expr(new Expr);
-            new_expr->_type = ExprType::App;
-            new_expr->_app.lhs = expr.release();
-            new_expr->_app.rhs = next.release();
-            expr = std::move(new_expr);
+bool Session::compile_query(Expr* expr, Query& query) {
+    {
+        TermScope previous(query.factory.get());
+        query.term.reset();
+    }
+    query.factory = _state->factory;
+    query.reaches.clear();
+
+    TermScope scope(_state->factory.get());
+    query.term.reset(compile_expr(*expr));
+    if (!query.term) return _state->fail("corrupted expression passed to function");
+
+    //follows definitions as written rather than their normal forms, which may
+    //not be computed yet and can only drop names. The prelude's own references
+    //cannot change, so they need no following
+    std::vector<Symbol> direct;
+    term_globals(query.term.get(), direct);
+    std::deque<_VariableDef>& variables = _state->env.variables;
+    std::vector<bool> seen(variables.size(), false);
+    std::vector<VarHandle> pending;
+    for (Symbol sym : direct) {
+        query.reaches.push_back(sym);
+        VarHandle* handle = _state->env.index.find(symbol_name(sym));
+        if (!handle || seen[*handle]) continue;
+        seen[*handle] = true;
+        pending.push_back(*handle);
+    }
+    while (!pending.empty()) {
+        _VariableDef& def = variables[pending.back()];
+        pending.pop_back();
+        for (VarHandle h : def.deps) {
+            if (seen[h]) continue;
+            seen[h] = true;
+            query.reaches.push_back(variables[h].id);
+            pending.push_back(h);
         }
     }
 
-    PARSE_EXPR_EOL:
-    if (!expr) {
-        parse_bad_token_err();
-        return nullptr;
-    }
+    _state->has_error = false;
+    return true;
+}
 
-    return expr;
+void Session::prepare_query(const Query& query) {
+    TermScope scope(_state->factory.get());
+    _state->prepare_globals(query.term.get());
 }
 
-static std::optional<Expr> _reset_and_parse_expr() {
-    has_error = false;
-    p_token = 0;
+bool query_reads_only(const ReduceOptions& options) {
+    return (options.backend == Backend::Recursive || options.backend == Backend::Parallel) &&
+        options.strategy == Strategy::Applicative && !options.lazy && !options.native;
+}
+
+const char* options_error(const ReduceOptions& options) {
+    if (options.strategy != Strategy::Whnf && options.strategy != Strategy::Hnf) return nullptr;
+    if (options.backend != Backend::Recursive) return "only the recursive backend reduces to whnf or hnf";
+    if (options.native) return "native arithmetic does not reduce to whnf or hnf";
+    return nullptr;
+}
 
-    std::unique_ptr<Expr> expr = parse_expr();
-    if (!expr) return {};
+Expr* Session::run_query(const Query& query, const ReduceOptions& options, std::string& error_text) const {
+    if (const char* error = options_error(options)) {
+        error_text = error;
+        return nullptr;
+    }
+    try {
+        return _run_query(query, options, error_text);
+    } catch (const std::bad_alloc&) {
+        error_text = "out of memory";
+        return nullptr;
+    }
+}
 
-    if (t_tokens[p_token] != TOKEN_EOL) {
-        parse_bad_token_err();
-        return {};
+Expr* Session::_run_query(const Query& query, const ReduceOptions& options, std::string& error_text) const {
+    _FlushStats stats;
+    EvalContext ctx;
+    _limit(ctx, options);
+    ctx.lookup = _State::lookup;
+    ctx.env = _state.get();
+
+    if (query_reads_only(options)) {
+        STAT_TIME(eval_ns);
+        ParallelOptions parallel;
+        parallel.threads = 1;
+        Expr* result = parallel_normalize(query.term.get(), ctx, parallel);
+        if (!result) error_text = ctx.error;
+        return result;
     }
 
-    auto op = std::make_optional<Expr>();
-    *op = std::move(*expr);
-    expr.reset();
-    return op;
+    //every other backend builds terms, which is why these queries run one at a time
+    TermScope scope(query.factory.get());
+    ctx.start(Arena::current());
+    TermPtr normal;
+    {
+        STAT_TIME(eval_ns);
+        normal.reset(_state->reduce(query.term.get(), options, ctx));
+    }
+    if (!normal) {
+        error_text = ctx.error;
+        return nullptr;
+    }
+    STAT_TIME(read_back_ns);
+    return term_to_expr(normal.get());
 }
 
-static std::optional<Instruction> parse() {
-    has_error = false;
-    p_token = 0;
+std::shared_ptr<const Prelude> Session::freeze() {
+    if (_state->prelude) {
+        _state->fail("a session that has a prelude cannot be frozen");
+        return nullptr;
+    }
 
-    std::optional<Instruction> inst = std::make_optional<Instruction>();
+    TermScope scope(_state->factory.get());
+    std::deque<_VariableDef>& variables = _state->env.variables;
+    for (_VariableDef& def : variables) {
+        def.value.reset();
+        const Term* body = def.term ? _state->definition(def) : nullptr;
+        if (!body) continue;
+        //sessions read the prelude from any thread, so its code is compiled now
+        def.code[0].reset(bytecode_compile(body, false));
+        def.code[1].reset(bytecode_compile(body, true));
+        if (def.normal) continue;
+
+        //evaluated as written, so every Global node in it needs its handle now
+        std::vector<Symbol> globals;
+        term_globals(def.term.get(), globals);
+        for (Symbol sym : globals) {
+            TermPtr global(term_global(sym));
+            VarHandle* handle = _state->env.index.find(symbol_name(sym));
+            if (handle) global->global.handle = *handle;
+        }
+    }
 
-    if (t_tokens.size() >= 3 && t_tokens[0] == TOKEN_ID && t_tokens[1] == TOKEN_ASSIGN) {
-        p_token = 2;
-        auto expr = parse_expr();
-        if (!expr) return std::nullopt;
-        inst->assign_to = t_ids[0];
-        inst->expr = std::move(expr);
+    std::shared_ptr<TermFactory> factory = _state->factory;
+    if (factory) {
+        factory->freeze();
     } else {
-        auto expr = parse_expr();
-        if (!expr) return std::nullopt;
-        inst->expr = std::move(expr);
+        TermFactory::current()->freeze();
     }
+    //the session goes on in a factory of its own, its old one now only keeps
+    //the prelude's nodes alive
+    _state->factory.reset(new TermFactory);
+
+    std::shared_ptr<Prelude> prelude(new Prelude);
+    prelude->factory = std::move(factory);
+    prelude->env = std::move(_state->env);
+    _state->env = _Environment();
+    _state->prelude = prelude;
+    _state->has_error = false;
+    return prelude;
+}
 
-    if (t_tokens[p_token] != TOKEN_EOL) {
-        parse_bad_token_err();
-        return std::nullopt;
+static void _add_definition(SnapshotWriter& writer, const _VariableDef& def, bool with_normal) {
+    uint32_t term = writer.add_term(def.term.get());
+    uint32_t normal = SNAPSHOT_NONE;
+    uint32_t flags = 0;
+    if (with_normal) {
+        if (def.normal) normal = writer.add_term(def.normal.get());
+        if (def.no_normal) flags |= SNAPSHOT_NO_NORMAL;
     }
-    
-    return inst;
+    writer.add_definition(def.id, term, normal, flags);
 }
 
-std::optional<Instruction> interpret_expression(std::string_view expr_str) {
-    using namespace std::string_literals;
-
-    t_expression_string = expr_str;
-    tokenize();
-    //for (int i = 0; i < t_tokens.size(); i++) {
-    //    printf("%d ", t_tokens[i]);
-    //}
-    if (has_error) return std::nullopt;
-    std::optional<Instruction> inst = parse();
-    if (has_error) return std::nullopt;
+bool Session::save_snapshot(const char* path) {
+    TermScope scope(_state->factory.get());
+    SnapshotWriter writer;
+    _Environment& env = _state->env;
+
+    //a prelude definition's normal form was computed against the prelude, it
+    //only holds after a reload if the session replaced none of its names
+    bool replaced = false;
+    for (const _VariableDef& def : env.variables) replaced = replaced || (def.term && def.inherited);
+
+    if (_state->prelude) {
+        for (const _VariableDef& def : _state->prelude->env.variables) {
+            if (!def.term) continue;
+            const VarHandle* own = env.index.find(symbol_name(def.id));
+            if (own && env.variables[*own].term) continue;
+            _add_definition(writer, def, !replaced);
+        }
+    }
+    for (const _VariableDef& def : env.variables) {
+        if (def.term) _add_definition(writer, def, true);
+    }
 
-    return inst;
+    std::string error;
+    if (!writer.write(path, error)) return _state->fail(error);
+    _state->has_error = false;
+    return true;
 }
 
-std::optional<Expr> parse_expression(std::string_view expr_str) {
-    t_expression_string = expr_str;
-    tokenize();
-    //for (int i = 0; i < t_tokens.size(); i++) {
-    //    printf("%d ", t_tokens[i]);
-    //}
-    if (has_error) return std::nullopt;
-    std::optional<Expr> expr = _reset_and_parse_expr();
-    return expr;
-}
-
-/*
-struct VariableMapHash {
-    size_t operator()(const std::string& key) const { return std::hash<std::string_view>()(key); }
-    size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
-    size_t operator()(const char* key) const { return std::hash<std::string_view>()(key); }
-};
+bool Session::load_snapshot(const char* path) {
+    std::string error;
+    std::unique_ptr<Snapshot> snapshot = Snapshot::open(path, error);
+    if (!snapshot) return _state->fail(error);
+
+    TermScope scope(_state->factory.get());
+    std::vector<TermPtr> terms;
+    snapshot->build_terms(terms);
+
+    const SnapshotHeader& header = snapshot->header();
+    const SnapshotDef* defs = snapshot->definitions();
+    std::vector<bool> defined(header.string_count, false);
+    for (uint32_t i = 0; i < header.def_count; i++) defined[defs[i].name] = true;
+
+    //a normal form is only valid where the names it was computed with still
+    //mean what they meant when it was saved
+    bool keep_normals = true;
+    for (uint32_t i = 0; i < header.node_count && keep_normals; i++) {
+        const SnapshotNode& node = snapshot->nodes()[i];
+        if (node.type != SnapshotNodeType::Global || defined[node.a]) continue;
+        if (_state->find_var(snapshot->string(node.a))) keep_normals = false;
+    }
 
-std::unordered_map<std::string, Expr*, VariableMapHash> variables;
-struct StoredValue {
-    std::string key;
-    Expr* original_value;
-};
-std::vector<StoredValue> binding_stack;
-
-static void _push_binding(const char* id, Expr* val) {
-    auto& sv = binding_stack.emplace_back();
-    sv.key.assign(id);
-    auto it = variables.find(sv.key);
-    if (it == variables.end()) {
-        sv.original_value = nullptr;
-        variables.emplace(sv.key, val);
-    } else {
-        sv.original_value = it->second;
-        it->second = val;
+    //every term is set before any normal form, since setting a definition
+    //drops the normal forms of the ones that use it
+    std::vector<_VariableDef*> loaded(header.def_count);
+    for (uint32_t i = 0; i < header.def_count; i++) {
+        loaded[i] = _state->get_or_add_var(snapshot->symbol(defs[i].name));
+        _state->set_definition(loaded[i], term_retain(terms[defs[i].term].get()));
+    }
+    if (keep_normals) {
+        for (uint32_t i = 0; i < header.def_count; i++) {
+            if (defs[i].normal != SNAPSHOT_NONE) loaded[i]->normal.reset(term_retain(terms[defs[i].normal].get()));
+            loaded[i]->no_normal = (defs[i].flags & SNAPSHOT_NO_NORMAL) != 0;
+        }
     }
-}
 
-static void _pop_binding() {
-    auto& sv = binding_stack.back();
-    variables[sv.key] = sv.original_value;
-    binding_stack.pop_back();
+    _state->has_error = false;
+    return true;
 }
-*/
-struct _VariableDef {
-    std::unique_ptr<char[]> id;
-    std::unique_ptr<Expr> value;
-};
 
-static std::vector<_VariableDef> _variables;
+std::optional<Instruction> interpret_expression(std::string_view expr_str) {
+    return default_session().interpret_expression(expr_str);
+}
 
-static std::vector<_VariableDef>::iterator _find_var(const char* id) {
-    for (size_t i = 0; i < _variables.size(); i++) {
-        if (strcmp(_variables[i].id.get(), id) == 0) {
-            return _variables.begin() + i;
-        }
-    }
+std::optional<Expr> parse_expression(std::string_view expr_str) {
+    return default_session().parse_expression(expr_str);
+}
 
-    return _variables.end();
+std::string get_error_text() {
+    return default_session().get_error_text();
 }
 
 void clear_variables() {
-    _variables.clear();
+    default_session().clear_variables();
 }
 
 bool clear_variable(const char* id) {
-    using namespace std::string_literals;
-    auto it = _find_var(id);
-    if (it == _variables.end()) {
-        has_error = true;
-        error = "variable "s + id + " is not assigned";
-        return false;
-    }
-    
-    _variables.erase(it);
-    has_error = false;
-    return true;
+    return default_session().clear_variable(id);
 }
 
 bool set_variable(const char* id, const Expr& expr) {
-    using namespace std::string_literals;
-    auto it = _find_var(id);
-    _VariableDef* def;
-    if (it == _variables.end()) {
-        def = &_variables.emplace_back();
-    } else {
-        def = &*it;
-    }
-
-    def->id.reset(strdup(id));
-    def->value.reset(expr.clone());
-    has_error = false;
-    return true;
+    return default_session().set_variable(id, expr);
 }
 
 bool set_variable(const char* id, const char* raw_expr) {
-    std::optional<Expr> expr = parse_expression(raw_expr);
-    if (!expr) return false;
-    return set_variable(id, *expr);
+    return default_session().set_variable(id, raw_expr);
 }
 
 Expr* get_variable(const char* id) {
-    using namespace std::string_literals;
-    auto it = _find_var(id);
-    if (it == _variables.end()) {
-        has_error = true;
-        error = "variable "s + id + " is not assigned";
-        return nullptr;
-    }
+    return default_session().get_variable(id);
+}
 
-    has_error = false;
-    return it->value.get();
+VarHandle resolve_variable(const char* id) {
+    return default_session().resolve_variable(id);
 }
 
-struct _Binding {
-    std::unique_ptr<char[]> id;
-    std::unique_ptr<Expr> expr;
-};
+Expr* get_variable(VarHandle handle) {
+    return default_session().get_variable(handle);
+}
 
-using _Bindings = std::vector<_Binding>;
+Expr* reduce_expression(Expr* expr, const ReduceOptions& options) {
+    return default_session().reduce_expression(expr, options);
+}
 
-static bool _bind_get(const _Bindings& bindings, const char* id, Expr** bind_result) {
-    for (auto it = bindings.rbegin(); it != bindings.rend(); it++) {
-        if (strcmp(it->id.get(), id) == 0) {
-            *bind_result = it->expr.get();
-            return true;
-        }
-    }
-    return false;
+bool reduce_in_place(Expr&& expr, const ReduceOptions& options) {
+    return default_session().reduce_in_place(std::move(expr), options);
 }
 
-Expr* _reduce_expression(Expr* expr, _Bindings& bindings) {
-    switch (expr->_type) {
-    default:
-    case ExprType::Empty:
-        has_error = true;
-        error = "corrupted expression passed to function";
-        return nullptr;
-    case ExprType::Var: {
-        Expr* bind = nullptr;
-        bool has_bind = _bind_get(bindings, expr->_var, &bind);
-        if (!has_bind) {
-            Expr* value = get_variable(expr->_var);
-            if (value == nullptr) return nullptr; //error propagates
-            return _reduce_expression(value, bindings);
-        }
-        else if (bind == nullptr) {
-            has_error = false;
-            return expr->clone();
-        }
-        else {
-            return _reduce_expression(bind, bindings);
-        }
-    }
-    case ExprType::Fn: {
-        auto& binding = bindings.emplace_back();
-        binding.id.reset(strdup(expr->_fn.id));
-        Expr* reduced_inner = _reduce_expression(expr->_fn.body, bindings);
-        bindings.pop_back();
-        if (reduced_inner == nullptr) return nullptr; //error propagates
-        Expr* reduced = new Expr;
-        reduced->_type = ExprType::Fn;
-        reduced->_fn.id = strdup(expr->_fn.id);
-        reduced->_fn.body = reduced_inner;
-        has_error = false;
-        return reduced;
-    }
-    case ExprType::App: {
-        Expr* reduced_lhs = _reduce_expression(expr->_app.lhs, bindings);
-        if (reduced_lhs == nullptr) return nullptr; //error propagates
-        Expr* reduced_rhs = _reduce_expression(expr->_app.rhs, bindings);
-        if (reduced_rhs == nullptr) {
-            delete reduced_lhs;
-            return nullptr;
-        }
-        
-        auto& binding = bindings.emplace_back();
-        binding.id.reset(strdup(expr->_fn.id));
-        binding.expr.reset(reduced_rhs);
-        Expr* reduced = _reduce_expression(reduced_lhs->_fn.body, bindings); //error propagates
-        bindings.pop_back();
+bool compile_query(Expr* expr, Query& query) {
+    return default_session().compile_query(expr, query);
+}
 
-        delete reduced_lhs;
-        return reduced;
-    }
-    }
+void prepare_query(const Query& query) {
+    default_session().prepare_query(query);
+}
+
+Expr* run_query(const Query& query, const ReduceOptions& options, std::string& error_text) {
+    return default_session().run_query(query, options, error_text);
+}
+
+bool save_snapshot(const char* path) {
+    return default_session().save_snapshot(path);
 }
 
-Expr* reduce_expression(Expr* expr) {
-    _Bindings bindings;
-    return _reduce_expression(expr, bindings);
+bool load_snapshot(const char* path) {
+    return default_session().load_snapshot(path);
 }
\ No newline at end of file
@@ -1,16 +1,148 @@
 #pragma once
 
 #include "expr.hpp"
+#include "symbol.hpp"
+#include "term.hpp"
+#include <atomic>
 #include <memory>
 #include <string_view>
 #include <string>
 #include <optional>
+#include <cstdint>
+#include <vector>
 
 struct Instruction {
     std::string assign_to; //blank if this is an output instruction
     std::unique_ptr<Expr> expr;
 };
 
+// Stable slot of a name in the environment. It stays valid across clears and
+// reassignments of that name, so callers can resolve once and skip hashing.
+using VarHandle = uint32_t;
+constexpr VarHandle NO_VAR_HANDLE = UINT32_MAX; //name was never assigned
+
+enum class Backend {
+    Recursive,  //evaluator running on the C++ stack
+    Machine,    //abstract machine with an explicit heap stack, for deep terms
+    Parallel,   //strict evaluation with the read-back of wide terms spread over threads
+    Net,        //optimal reduction of an interaction net, for terms that share work tree copying repeats
+    Vm          //definitions compiled once to bytecode and run on a VM loop, see bytecode.hpp
+};
+
+// How far a query is reduced and in which order. The two partial forms are
+// cheaper when only the outermost shape of the result matters, such as
+// whether it is TRUE or FALSE. Only the recursive backend computes them, and
+// without native arithmetic: asking for them with anything else fails the
+// query (see options_error).
+enum class Strategy {
+    Applicative,    //normal form, arguments evaluated before they are passed
+    Normal,         //normal form, arguments evaluated when first used, the same as `lazy`
+    Whnf,           //call-by-name to weak head normal form: nothing under a lambda, no arguments of a stuck head
+    Hnf             //head normal form: under leading lambdas too, until a variable heads the body
+};
+
+struct ReduceOptions {
+    Backend backend = Backend::Recursive;
+    Strategy strategy = Strategy::Applicative;
+    bool lazy = false; //call-by-need: arguments are evaluated at most once, and only if used
+    //limits that make a reduction fail with an error instead of running away,
+    //0 meaning none (see EvalContext)
+    uint64_t max_steps = 0; //beta reductions
+    size_t max_bytes = 0; //memory taken by values and new term nodes
+    uint64_t timeout_ms = 0;
+    const std::atomic<bool>* cancelled = nullptr; //another thread sets it to abort the reduction
+    bool native = false; //Recursive only: Church numerals and booleans as literals with built-in arithmetic, see native.hpp
+    unsigned threads = 0; //Parallel only: threads taking part, 0 is one per hardware thread
+    size_t parallel_threshold = 2048; //Parallel only: estimated size under which subterms stay on one thread
+};
+
+// Query compiled by Session::compile_query. It keeps the factory that built
+// its term alive and releases the term there.
+struct Query {
+    std::shared_ptr<TermFactory> factory; //null for the process-wide factory
+    TermPtr term;
+    std::vector<Symbol> reaches; //every name the result may depend on, directly or through definitions
+
+    ~Query() {
+        TermScope scope(factory.get());
+        term.reset();
+    }
+};
+
+// Definitions frozen by Session::freeze. A prelude never changes, so any number
+// of sessions on any number of threads can build on one without copying it.
+struct Prelude;
+
+// An interpreter: an environment of definitions with its own term factory and
+// error state. Sessions share nothing mutable, so separate sessions can run on
+// separate threads at the same time; one session must be used by one thread at
+// a time.
+//
+// A session created on a prelude sees every prelude definition until it
+// assigns the name itself. Prelude definitions are closed over the prelude:
+// reassigning a name in the session does not change what they compute.
+struct Session {
+    explicit Session(std::shared_ptr<const Prelude> prelude = nullptr);
+    ~Session();
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    std::optional<Instruction> interpret_expression(std::string_view expr_str);
+    std::optional<Expr> parse_expression(std::string_view expr_str);
+    std::string get_error_text() const;
+
+    void clear_variables(); //prelude definitions stay visible
+    bool clear_variable(const char* id);
+    bool set_variable(const char* id, const Expr& expr);
+    bool set_variable(const char* id, const char* raw_expr);
+    Expr* get_variable(const char* id);
+    VarHandle resolve_variable(const char* id);
+    Expr* get_variable(VarHandle handle);
+
+    Expr* reduce_expression(Expr* expr, const ReduceOptions& options = {});
+    // Like reduce_expression, but consumes `expr` and leaves the normal form in
+    // it, built from its own nodes as far as they go. On failure `expr` is
+    // left as it was, or empty if memory ran out while reading it back.
+    bool reduce_in_place(Expr&& expr, const ReduceOptions& options = {});
+
+    // Reduction split up for evaluating many queries at once. compile_query
+    // and prepare_query change the session and run on its thread. run_query
+    // reduces with `options`; when query_reads_only(options) it only reads
+    // and may run on any number of threads at the same time, as long as no
+    // definition changes between prepare_query and the end of the run.
+    // Otherwise it builds terms in the session and runs on one thread at a
+    // time.
+    bool compile_query(Expr* expr, Query& query);
+    void prepare_query(const Query& query); //normalizes every definition the query reaches
+    Expr* run_query(const Query& query, const ReduceOptions& options, std::string& error_text) const;
+
+    // Normalizes every definition and moves them all into a new prelude, which
+    // the session then builds on. Fails if the session already has a prelude.
+    std::shared_ptr<const Prelude> freeze();
+
+    // Writes every definition the session sees, prelude ones included, with
+    // the normal forms computed so far, to a snapshot file (see snapshot.hpp).
+    // A prelude definition is written as it reads, so after loading it uses
+    // the session's own definition of a name both of them define.
+    bool save_snapshot(const char* path);
+    // Assigns every definition in a snapshot file, as set_variable would. The
+    // stored normal forms are taken over unless a name they may reach has a
+    // definition here that the snapshot lacks.
+    bool load_snapshot(const char* path);
+
+private:
+    struct _State;
+    std::unique_ptr<_State> _state;
+
+    Expr* _run_query(const Query& query, const ReduceOptions& options, std::string& error_text) const;
+
+    friend Session& default_session();
+};
+
+// Process-wide session behind the functions below. It builds terms in the
+// process-wide factory.
+Session& default_session();
+
 std::optional<Instruction> interpret_expression(std::string_view expr_str);
 std::optional<Expr> parse_expression(std::string_view expr_str);
 std::string get_error_text();
@@ -20,6 +152,16 @@ bool clear_variable(const char* id);
 bool set_variable(const char* id, const Expr& expr);
 bool set_variable(const char* id, const char* raw_expr);
 Expr* get_variable(const char* id);
+VarHandle resolve_variable(const char* id);
+Expr* get_variable(VarHandle handle);
 
-Expr* reduce_expression(Expr* expr);
+Expr* reduce_expression(Expr* expr, const ReduceOptions& options = {});
+bool reduce_in_place(Expr&& expr, const ReduceOptions& options = {});
+bool compile_query(Expr* expr, Query& query);
+void prepare_query(const Query& query);
+Expr* run_query(const Query& query, const ReduceOptions& options, std::string& error_text);
+bool query_reads_only(const ReduceOptions& options); //strict evaluation by the recursive or parallel backend
+const char* options_error(const ReduceOptions& options); //why no backend reduces with `options`, nullptr if one does
+bool save_snapshot(const char* path);
+bool load_snapshot(const char* path);
 //Expr* apply_expression(Expr* expr, Expr* value);
\ No newline at end of file
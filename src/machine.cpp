@@ -0,0 +1,279 @@
+#include "machine.hpp"
+#include "value.hpp"
+
+#include <new>
+#include <vector>
+
+enum class _FrameType : uint8_t {
+    EvalArg,    //function evaluated, argument still to evaluate
+    Apply,      //argument evaluated, apply the function held here
+    ApplyTo,    //function evaluated, apply it to the thunk held here (lazy)
+    Update,     //store the returned value in the thunk being forced
+    QuoteBody,  //read back the returned value at `depth`
+    QuoteLam,   //body read back, wrap it in a lambda
+    QuoteArg,   //function of a stuck application read back, now its argument
+    BuildApp    //both sides of a stuck application read back
+};
+
+struct _Frame {
+    _FrameType type;
+    uint32_t depth;
+    union {
+        struct { const Term* term; const Env* env; } arg;
+        Value* fn;
+        Value* thunk;
+        Symbol hint;
+        Value* value;
+        Term* built;
+    };
+#if LAMBDA_STATS
+    Symbol centre = NO_SYMBOL; //EvalArg and Update: global the evaluation goes on under, for the profile
+#endif
+};
+
+enum class _Mode {
+    Eval,   //evaluate `term` in `env`
+    Force,  //`value` came out of an environment, force it if it is a thunk
+    Return, //hand `value` to the top frame
+    Quote,  //read back `value` at `depth`
+    Built   //hand the read-back `built` to the top frame
+};
+
+static void _release_frames(std::vector<_Frame>& stack) {
+    for (_Frame& frame : stack) {
+        if (frame.type == _FrameType::BuildApp) term_release(frame.built);
+    }
+}
+
+static Term* _run(const Term* term, EvalContext& ctx, std::vector<_Frame>& stack) {
+    using namespace std::string_literals;
+
+    Arena* arena = Arena::current();
+    const Env* empty = env_empty(arena);
+
+    _Mode mode = _Mode::Eval;
+    const Env* env = empty;
+    Value* value = nullptr;
+    Term* built = nullptr;
+    uint32_t depth = 0;
+
+    //the result of the whole evaluation is read back at depth 0
+    stack.push_back({ _FrameType::QuoteBody, 0, {} });
+
+    while (true) {
+        switch (mode) {
+        case _Mode::Eval:
+            switch (term->type) {
+            case TermType::Var:
+                value = env->lookup(term->index);
+                mode = _Mode::Force;
+                break;
+            case TermType::Lam:
+                value = value_new(arena, ValueType::Closure);
+                value->closure.hint = term->lam.hint;
+                value->closure.body = term->lam.body;
+                value->closure.env = env;
+                mode = _Mode::Return;
+                break;
+            case TermType::App: {
+                _Frame& frame = stack.emplace_back();
+                if (ctx.lazy) {
+                    frame.type = _FrameType::ApplyTo;
+                    frame.thunk = thunk_new(arena, term->app.rhs, env);
+                } else {
+                    frame.type = _FrameType::EvalArg;
+                    frame.arg.term = term->app.rhs;
+                    frame.arg.env = env;
+#if LAMBDA_STATS
+                    frame.centre = stats_centre;
+#endif
+                }
+                term = term->app.lhs;
+                break;
+            }
+            case TermType::Global: {
+                stat_enter_global(term->global.id);
+                const Term* def = ctx.resolve(term);
+                if (!def) {
+                    ctx.error = "variable "s + symbol_cstr(term->global.id) + " is not assigned";
+                    _release_frames(stack);
+                    return nullptr;
+                }
+                stat_set_centre(term->global.id);
+                term = def;
+                env = empty;
+                break;
+            }
+            }
+            break;
+
+        case _Mode::Force:
+            mode = _Mode::Return;
+            if (value->type != ValueType::Thunk) break;
+            if (value->thunk.result) {
+                value = value->thunk.result;
+                break;
+            }
+            if (thunk_is_forcing(value)) {
+                ctx.error = "argument depends on its own value";
+                _release_frames(stack);
+                return nullptr;
+            }
+            stack.push_back({ _FrameType::Update, 0, {} });
+            stack.back().thunk = value;
+#if LAMBDA_STATS
+            stack.back().centre = stats_centre;
+            stats_centre = value->centre;
+#endif
+            STAT_INC(thunks_forced);
+            term = value->thunk.term;
+            env = value->thunk.env;
+            value->thunk.term = nullptr;
+            mode = _Mode::Eval;
+            break;
+
+        case _Mode::Return: {
+            _Frame& frame = stack.back();
+            switch (frame.type) {
+            case _FrameType::EvalArg:
+                term = frame.arg.term;
+                env = frame.arg.env;
+#if LAMBDA_STATS
+                stats_centre = frame.centre;
+#endif
+                frame.type = _FrameType::Apply;
+                frame.fn = value;
+                mode = _Mode::Eval;
+                break;
+            case _FrameType::Apply:
+            case _FrameType::ApplyTo: {
+                Value* fn = frame.type == _FrameType::Apply ? frame.fn : value;
+                Value* arg = frame.type == _FrameType::Apply ? value : frame.thunk;
+                stack.pop_back();
+                if (fn->type == ValueType::Closure) {
+                    ctx.held_bytes = stack.capacity() * sizeof(_Frame);
+                    if (!ctx.step()) {
+                        _release_frames(stack);
+                        return nullptr;
+                    }
+                    stat_step(fn->centre);
+                    stat_set_centre(fn->centre);
+                    stat_depth(stack.size());
+                    term = fn->closure.body;
+                    env = env_extend(arena, fn->closure.env, arg);
+                    mode = _Mode::Eval;
+                } else {
+                    Value* app = value_new(arena, ValueType::NApp);
+                    app->napp.fn = fn;
+                    app->napp.arg = arg;
+                    value = app;
+                }
+                break;
+            }
+            case _FrameType::Update:
+                frame.thunk->thunk.result = value;
+#if LAMBDA_STATS
+                stats_centre = frame.centre;
+#endif
+                stack.pop_back();
+                break;
+            case _FrameType::QuoteBody:
+                depth = frame.depth;
+                stack.pop_back();
+                mode = _Mode::Quote;
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+
+        case _Mode::Quote:
+            switch (value->type) {
+            case ValueType::Closure: {
+                ctx.held_bytes = stack.capacity() * sizeof(_Frame);
+                if (!ctx.step()) {
+                    _release_frames(stack);
+                    return nullptr;
+                }
+                stat_step(value->centre);
+                stat_set_centre(value->centre);
+                Value* var = value_new(arena, ValueType::NVar);
+                var->level = depth;
+                _Frame& lam = stack.emplace_back();
+                lam.type = _FrameType::QuoteLam;
+                lam.hint = value->closure.hint;
+                stack.push_back({ _FrameType::QuoteBody, depth + 1, {} });
+                term = value->closure.body;
+                env = env_extend(arena, value->closure.env, var);
+                mode = _Mode::Eval;
+                break;
+            }
+            case ValueType::NVar:
+                built = term_var(depth - 1 - value->level);
+                mode = _Mode::Built;
+                break;
+            case ValueType::NApp: {
+                _Frame& frame = stack.emplace_back();
+                frame.type = _FrameType::QuoteArg;
+                frame.depth = depth;
+                frame.value = value->napp.arg;
+                value = value->napp.fn;
+                break;
+            }
+            case ValueType::Thunk:
+                //force it, then come back to read the result back at this depth
+                stack.push_back({ _FrameType::QuoteBody, depth, {} });
+                mode = _Mode::Force;
+                break;
+            //native literals are made by the recursive backend alone
+            case ValueType::Numeral:
+            case ValueType::NumeralFn:
+            case ValueType::Boolean:
+            case ValueType::BooleanFn:
+            case ValueType::Delta:
+                ctx.error = "native values cannot be read back by the machine";
+                _release_frames(stack);
+                return nullptr;
+            }
+            break;
+
+        case _Mode::Built: {
+            if (stack.empty()) return built;
+            _Frame& frame = stack.back();
+            switch (frame.type) {
+            case _FrameType::QuoteLam:
+                built = term_lam(frame.hint, built);
+                stack.pop_back();
+                break;
+            case _FrameType::QuoteArg:
+                value = frame.value;
+                depth = frame.depth;
+                frame.type = _FrameType::BuildApp;
+                frame.built = built;
+                mode = _Mode::Quote;
+                break;
+            case _FrameType::BuildApp:
+                built = term_app(frame.built, built);
+                stack.pop_back();
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+        }
+    }
+}
+
+Term* machine_normalize_term(const Term* term, EvalContext& ctx) {
+    std::vector<_Frame> stack;
+    //the stack lives outside the arena, failing to grow it ends the run like the memory limit does
+    try {
+        return _run(term, ctx, stack);
+    } catch (const std::bad_alloc&) {
+        _release_frames(stack);
+        ctx.error = "out of memory";
+        return nullptr;
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "eval.hpp"
+
+// Same contract as normalize_term, but runs on an abstract machine instead of
+// the C++ stack: a CEK-style evaluator whose continuation, together with the
+// pending read-back work, is an explicit heap array. Nesting depth is limited
+// only by memory, and the stack never holds more than the live frames.
+Term* machine_normalize_term(const Term* term, EvalContext& ctx);
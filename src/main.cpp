@@ -1,35 +1,57 @@
 #include "expr.hpp"
 #include "interp.hpp"
+#include "arena.hpp"
+#include "batch.hpp"
+#include "command.hpp"
+#include "printer.hpp"
+#include "server.hpp"
+#include "stats.hpp"
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
 
-void run_and_output(const char* s) {
+void run_and_output(const char* s, size_t limit, ReduceOptions& options) {
+    if (is_command(s)) {
+        std::string text;
+        run_command(s, options, text);
+        std::cout << text;
+        return;
+    }
+
+    QueryStats stats;
+    //everything built for this line lives in the arena and is dropped with it
+    Arena arena;
+    ArenaScope scope(&arena);
+
     auto instr = interpret_expression(s);
     if (!instr) {
-        std::cout << "ERROR: " << get_error_text() << std::endl;
+        std::cout << "ERROR: " << get_error_text() << '\n';
         return;
     }
     
     std::cout << instr->expr->to_string();
     if (!instr->assign_to.empty())
         std::cout << " [ASSIGNS TO '" << instr->assign_to << "']";
-    std::cout << std::endl;
+    std::cout << '\n';
 
     if (!instr->assign_to.empty()) {
         bool success = set_variable(instr->assign_to.c_str(), *instr->expr);
         if (!success) {
-            std::cout << "ERROR: " << get_error_text() << std::endl;
+            std::cout << "ERROR: " << get_error_text() << '\n';
         }
     } else {
-        Expr* reduced = reduce_expression(instr->expr.get());
-        if (!reduced) {
-            std::cout << "ERROR: " << get_error_text() << std::endl;
+        if (!reduce_in_place(std::move(*instr->expr), options)) {
+            std::cout << "ERROR: " << get_error_text() << '\n';
         } else {
-            std::cout << "REDUCED: " << reduced->to_string() << std::endl;
+            std::string text = "REDUCED: ";
+            print_expr(*instr->expr, text, limit);
+            std::cout << text << '\n';
         }
-        delete reduced;
     }
+    //the nodes belong to the line's arena, which frees them all at once
+    instr->expr.release();
 }
 
 void check(bool result) {
@@ -38,7 +60,75 @@ void check(bool result) {
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
+    //lambda [-j threads] [-l limit] [-s snapshot] [-n] [-b backend] [-r strategy] [-x steps] [-m megabytes] [-t ms] [-S socket] [script]
+    //-n: queries compute Church arithmetic natively
+    //-b: queries reduce with recursive (the default), machine, net, vm or parallel,
+    //    which reads back over -j threads
+    //-r: queries reduce to applicative (the default) or normal order
+    //    normal form, to weak head normal form (whnf) or to head normal form (hnf)
+    //-x, -m, -t: queries give up after this many beta reductions, this much memory or this many milliseconds
+    //-S: serves the definitions loaded so far on a Unix socket instead, see server.hpp,
+    //    where queries are given 10 seconds and 256 MB unless -t and -m say otherwise
+    const char* script = nullptr;
+    const char* snapshot = nullptr;
+    const char* socket = nullptr;
+    unsigned threads = 0;
+    size_t limit = NO_PRINT_LIMIT;
+    ReduceOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            limit = (size_t)strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "normal") == 0) {
+                options.strategy = Strategy::Normal;
+            } else if (strcmp(name, "whnf") == 0) {
+                options.strategy = Strategy::Whnf;
+            } else if (strcmp(name, "hnf") == 0) {
+                options.strategy = Strategy::Hnf;
+            } else if (strcmp(name, "applicative") != 0) {
+                fprintf(stderr, "ERROR: unknown strategy %s\n", name);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            options.max_steps = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            options.max_bytes = (size_t)strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            options.timeout_ms = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            socket = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0) {
+            options.native = true;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "machine") == 0) {
+                options.backend = Backend::Machine;
+            } else if (strcmp(name, "net") == 0) {
+                options.backend = Backend::Net;
+            } else if (strcmp(name, "vm") == 0) {
+                options.backend = Backend::Vm;
+            } else if (strcmp(name, "parallel") == 0) {
+                options.backend = Backend::Parallel;
+            } else if (strcmp(name, "recursive") != 0) {
+                fprintf(stderr, "ERROR: unknown backend %s\n", name);
+                return 1;
+            }
+        } else {
+            script = argv[i];
+        }
+    }
+    options.threads = threads;
+    if (const char* error = options_error(options)) {
+        fprintf(stderr, "ERROR: %s\n", error);
+        return 1;
+    }
+
     //for (int i = 0; i < 10; i++) {
     //    char name[32];
     //    sprintf(name, "%d", i);
@@ -53,12 +143,35 @@ int main() {
     check(set_variable("FALSE", "\\a.\\b.b"));
     check(set_variable("NOT", "\\p.\\a.\\b.p a b"));
 
+    if (snapshot && !load_snapshot(snapshot)) {
+        fprintf(stderr, "ERROR: %s\n", get_error_text().c_str());
+        return 1;
+    }
+
+    if (socket) {
+        ServerOptions server;
+        server.path = socket;
+        server.workers = threads;
+        server.limit = limit;
+        server.reduce = options;
+        std::string error;
+        if (run_server(server, default_session().freeze(), error)) return 0;
+        fprintf(stderr, "ERROR: %s\n", error.c_str());
+        return 1;
+    }
+
+    if (script) {
+        if (run_script(script, threads, limit, options, stdout)) return 0;
+        fprintf(stderr, "ERROR: cannot read %s\n", script);
+        return 1;
+    }
+
     std::string line; 
     while (true)
     {
         printf(">");
         if (!std::getline(std::cin, line)) break;
         if (line.empty()) continue;
-        run_and_output(line.c_str());
+        run_and_output(line.c_str(), limit, options);
     }
 }
\ No newline at end of file
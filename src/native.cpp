@@ -0,0 +1,401 @@
+#include "native.hpp"
+#include "parser.hpp"
+#include "stats.hpp"
+#include "value.hpp"
+
+#include <memory>
+#include <unordered_set>
+
+// Each operator's normal form, closed, with the binders its results are named
+// after given names of their own. `results` lists those binders in the order
+// NativeOp::hints keeps their names.
+struct _Rule {
+    NativeOpKind kind;
+    uint32_t arity;
+    const char* source;
+    const char* results[6];
+};
+
+#define _PRED "(\\k.\\f.\\x.k (\\g.\\h.h (g f)) (\\u.x) (\\u.u))"
+
+static const _Rule _RULES[] = {
+    { NativeOpKind::Succ, 1, "\\n.\\rf.\\rx.rf (n rf rx)", { "rf", "rx" } },
+    { NativeOpKind::Pred, 1, "\\n.\\rf.\\rx.n (\\g.\\h.h (g rf)) (\\u.rx) (\\u.u)", { "rf", "rx" } },
+    { NativeOpKind::IsZero, 1, "\\n.n (\\x.\\fa.\\fb.fb) (\\ta.\\tb.ta)", { "ta", "tb", "fa", "fb" } },
+    { NativeOpKind::Add, 2, "\\m.\\n.\\rf.\\rx.m rf (n rf rx)", { "rf", "rx" } },
+    { NativeOpKind::Sub, 2, "\\m.\\n.n (\\k.\\rf.\\rx.k (\\g.\\h.h (g rf)) (\\u.rx) (\\u.u)) m", { "rf", "rx" } },
+    { NativeOpKind::Mul, 2, "\\m.\\n.\\rf.m (n rf)", { "rf" } },
+    { NativeOpKind::Exp, 2, "\\m.\\n.n m", {} },
+    { NativeOpKind::Leq, 2, "\\m.\\n.n " _PRED " m (\\x.\\fa.\\fb.fb) (\\ta.\\tb.ta)", { "ta", "tb", "fa", "fb" } },
+    //LEQ m n picks between LEQ n m and a second LEQ m n
+    { NativeOpKind::Eq, 2,
+        "\\m.\\n.n " _PRED " m (\\x.\\a.\\b.b) (\\a.\\b.a)"
+        " (m " _PRED " n (\\x.\\fa.\\fb.fb) (\\ta.\\tb.ta))"
+        " (n " _PRED " m (\\x.\\ga.\\gb.gb) (\\a.\\b.a))",
+        { "ta", "tb", "fa", "fb", "ga", "gb" } },
+};
+
+#undef _PRED
+
+constexpr size_t _RULE_COUNT = sizeof(_RULES) / sizeof(_RULES[0]);
+constexpr uint32_t _NO_SLOT = UINT32_MAX;
+
+//binder names of `term` in pre-order, which is the order _match walks in
+static void _binders(const Term* term, std::vector<Symbol>& out) {
+    std::vector<const Term*> pending;
+    pending.push_back(term);
+    while (!pending.empty()) {
+        const Term* t = pending.back();
+        pending.pop_back();
+        if (t->type == TermType::Lam) {
+            out.push_back(t->lam.hint);
+            pending.push_back(t->lam.body);
+        } else if (t->type == TermType::App) {
+            pending.push_back(t->app.rhs);
+            pending.push_back(t->app.lhs);
+        }
+    }
+}
+
+//the rules' terms, built once in a factory of their own and never released
+struct _Canon {
+    TermFactory factory;
+    const Term* terms[_RULE_COUNT];
+    uint32_t slots[_RULE_COUNT][6]; //per result binder, its position among the rule's binders
+
+    _Canon() {
+        TermScope scope(&factory);
+        ArenaScope heap(nullptr);
+        for (size_t i = 0; i < _RULE_COUNT; i++) {
+            Parser parser(_RULES[i].source);
+            std::unique_ptr<Expr> expr = parser.parse_expression();
+            terms[i] = compile_expr(*expr);
+
+            std::vector<Symbol> binders;
+            _binders(terms[i], binders);
+            for (size_t j = 0; j < 6; j++) {
+                slots[i][j] = _NO_SLOT;
+                if (!_RULES[i].results[j]) continue;
+                Symbol name = intern(_RULES[i].results[j]);
+                for (size_t k = 0; k < binders.size(); k++) {
+                    if (binders[k] == name) slots[i][j] = (uint32_t)k;
+                }
+            }
+        }
+    }
+};
+
+static const _Canon& _canon() {
+    static _Canon canon;
+    return canon;
+}
+
+//whether `term` is `rule` up to binder names, collecting its binder names in
+//pre-order on the way
+static bool _match(const Term* rule, const Term* term, std::vector<Symbol>& binders) {
+    std::vector<std::pair<const Term*, const Term*>> pending;
+    pending.push_back({ rule, term });
+    while (!pending.empty()) {
+        auto [r, t] = pending.back();
+        pending.pop_back();
+        if (r->type != t->type) return false;
+        switch (t->type) {
+            case TermType::Var:
+                if (r->index != t->index) return false;
+                break;
+            case TermType::Lam:
+                binders.push_back(t->lam.hint);
+                pending.push_back({ r->lam.body, t->lam.body });
+                break;
+            case TermType::App:
+                pending.push_back({ r->app.rhs, t->app.rhs });
+                pending.push_back({ r->app.lhs, t->app.lhs });
+                break;
+            case TermType::Global:
+                return false;
+        }
+    }
+    return true;
+}
+
+Native::Native(WrittenLookup written, void* env) : _written(written), _env(env) {
+    _step.reset(term_app(term_var(1), term_var(0)));
+}
+
+Native::_Shape& Native::_shape(const Term* def) {
+    auto [it, added] = _shapes.try_emplace(def);
+    _Shape& s = it->second;
+    if (!added) return s;
+    if (def->type != TermType::Lam || def->lam.body->type != TermType::Lam) return s;
+
+    //\f.\x.f (f (... x)), or \a.\b.a
+    const Term* body = def->lam.body->lam.body;
+    uint64_t n = 0;
+    while (body->type == TermType::App && body->app.lhs->type == TermType::Var && body->app.lhs->index == 1) {
+        n++;
+        body = body->app.rhs;
+    }
+    if (body->type == TermType::Var && (body->index == 0 || (body->index == 1 && n == 0))) {
+        s.kind = body->index == 0 ? _Kind::Numeral : _Kind::Boolean;
+        s.n = body->index == 0 ? n : 1;
+        s.hints[0] = def->lam.hint;
+        s.hints[1] = def->lam.body->lam.hint;
+        return s;
+    }
+
+    const _Canon& canon = _canon();
+    std::vector<Symbol> binders;
+    for (size_t i = 0; i < _RULE_COUNT; i++) {
+        binders.clear();
+        if (!_match(canon.terms[i], def, binders)) continue;
+        s.kind = _Kind::Op;
+        s.op.kind = _RULES[i].kind;
+        s.op.arity = _RULES[i].arity;
+        s.op.term = def;
+        for (size_t j = 0; j < 6; j++) {
+            s.op.hints[j] = canon.slots[i][j] == _NO_SLOT ? NO_SYMBOL : binders[canon.slots[i][j]];
+        }
+        break;
+    }
+    return s;
+}
+
+//A normal form has every operator it used inlined, so a definition that
+//refers to a recognized operator, directly or through other definitions,
+//runs as written instead
+const Term* Native::_run(const Term* global, const Term* def, _Shape& shape, Evaluator& ev) {
+    if (shape.run) return shape.run;
+    shape.run = def; //until decided, so recursive definitions see the normal form
+    const Term* written = _written ? _written(_env, global) : nullptr;
+    if (!written || written == def) return def;
+
+    std::vector<const Term*> pending;
+    std::unordered_set<const Term*> seen;
+    pending.push_back(written);
+    while (!pending.empty()) {
+        const Term* t = pending.back();
+        pending.pop_back();
+        if (!seen.insert(t).second) continue;
+        if (t->type == TermType::Lam) {
+            pending.push_back(t->lam.body);
+        } else if (t->type == TermType::App) {
+            pending.push_back(t->app.rhs);
+            pending.push_back(t->app.lhs);
+        } else if (t->type == TermType::Global) {
+            const Term* d = ev.ctx.resolve(t);
+            if (!d) continue;
+            _Shape& s = _shape(d);
+            if (s.kind == _Kind::Op || (s.kind == _Kind::None && _run(t, d, s, ev) != d)) {
+                shape.run = written;
+                break;
+            }
+        }
+    }
+    return shape.run;
+}
+
+static Value* _numeral(Evaluator& ev, uint64_t n, Symbol f, Symbol x) {
+    Value* v = value_new(ev.arena, ValueType::Numeral);
+    v->numeral.n = n;
+    v->numeral.f = f;
+    v->numeral.x = x;
+    return v;
+}
+
+static Value* _boolean(Evaluator& ev, bool value, Symbol a, Symbol b) {
+    Value* v = value_new(ev.arena, ValueType::Boolean);
+    v->boolean.value = value;
+    v->boolean.a = a;
+    v->boolean.b = b;
+    return v;
+}
+
+Value* Native::eval_global(const Term* global, const Term* def, Evaluator& ev) {
+    _Shape& s = _shape(def);
+    switch (s.kind) {
+        case _Kind::Numeral:
+            return _numeral(ev, s.n, s.hints[0], s.hints[1]);
+        case _Kind::Boolean:
+            return _boolean(ev, s.n != 0, s.hints[0], s.hints[1]);
+        case _Kind::Op: {
+            Value* v = value_new(ev.arena, ValueType::Delta);
+            v->delta.op = &s.op;
+            v->delta.args[0] = v->delta.args[1] = nullptr;
+            return v;
+        }
+        case _Kind::None:
+            break;
+    }
+    return ev.eval(_run(global, def, s, ev), ev.empty);
+}
+
+//counts the step pure reduction takes entering the lambda `fn` stands for
+static bool _enter(Value* fn, Evaluator& ev) {
+    if (!ev.ctx.step()) return false;
+    stat_step(fn->centre);
+    return true;
+}
+
+Value* Native::apply(Value* fn, Value* arg, Evaluator& ev) {
+    if (!_enter(fn, ev)) return nullptr;
+    Symbol caller = stat_centre();
+    stat_set_centre(fn->centre);
+    Value* v = nullptr;
+    switch (fn->type) {
+        case ValueType::Numeral:
+            v = value_new(ev.arena, ValueType::NumeralFn);
+            v->numeral_fn.n = fn->numeral.n;
+            v->numeral_fn.f = arg;
+            v->numeral_fn.x = fn->numeral.x;
+            break;
+        case ValueType::NumeralFn:
+            v = _iterate(fn, arg, ev);
+            break;
+        case ValueType::Boolean:
+            v = value_new(ev.arena, ValueType::BooleanFn);
+            v->boolean_fn.value = fn->boolean.value;
+            v->boolean_fn.b = fn->boolean.b;
+            v->boolean_fn.a = arg;
+            break;
+        case ValueType::BooleanFn:
+            v = ev.force(fn->boolean_fn.value ? fn->boolean_fn.a : arg);
+            break;
+        case ValueType::Delta: {
+            const NativeOp& op = *fn->delta.op;
+            Value* args[2] = { fn->delta.args[0], fn->delta.args[1] };
+            uint32_t count = args[0] ? 1 : 0;
+            args[count++] = arg;
+            if (count < op.arity) {
+                v = value_new(ev.arena, ValueType::Delta);
+                v->delta.op = &op;
+                v->delta.args[0] = args[0];
+                v->delta.args[1] = args[1];
+            } else {
+                v = _reduce(op, args, ev);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    stat_set_centre(caller);
+    return v;
+}
+
+//f (f (... x)), n times: built inside out when strict, and lazily as a chain of
+//thunks applying f to the one inside, as evaluating the body itself would
+Value* Native::_iterate(Value* fn, Value* x, Evaluator& ev) {
+    uint64_t n = fn->numeral_fn.n;
+    if (n == 0) return ev.force(x);
+    if (ev.ctx.lazy) {
+        for (uint64_t i = 1; i < n; i++) {
+            const Env* env = env_extend(ev.arena, env_extend(ev.arena, ev.empty, fn->numeral_fn.f), x);
+            x = thunk_new(ev.arena, _step.get(), env);
+        }
+        n = 1;
+    }
+    Value* f = ev.force(fn->numeral_fn.f);
+    if (!f) return nullptr;
+    for (uint64_t i = 0; i < n && x; i++) x = ev.apply(f, x);
+    return x;
+}
+
+static bool _power(uint64_t base, uint64_t exp, uint64_t& out) {
+    out = 1;
+    while (exp) {
+        if ((exp & 1) && __builtin_mul_overflow(out, base, &out)) return false;
+        exp >>= 1;
+        if (exp && __builtin_mul_overflow(base, base, &base)) return false;
+    }
+    return true;
+}
+
+Value* Native::_reduce(const NativeOp& op, Value** args, Evaluator& ev) {
+    //forced in the order pure reduction would need them, so lazily an operand
+    //it never looks at is left alone: the multiplier of MUL 0 n, and EXP's
+    //base, which comes second
+    uint32_t first = op.kind == NativeOpKind::Exp ? 1 : 0;
+    Value* a = ev.force(args[first]);
+    if (!a) return nullptr;
+    args[first] = a;
+    if (a->type != ValueType::Numeral) return _fallback(op, args, op.arity, ev);
+
+    const Symbol* h = op.hints;
+    uint64_t m = a->numeral.n;
+    Value* v = nullptr;
+    switch (op.kind) {
+        case NativeOpKind::Succ:
+            if (m == UINT64_MAX) return _fallback(op, args, op.arity, ev);
+            v = _numeral(ev, m + 1, h[0], h[1]);
+            break;
+        case NativeOpKind::Pred:
+            v = _numeral(ev, m ? m - 1 : 0, h[0], h[1]);
+            break;
+        case NativeOpKind::IsZero:
+            v = m == 0 ? _boolean(ev, true, h[0], h[1]) : _boolean(ev, false, h[2], h[3]);
+            break;
+        default: {
+            if (op.kind == NativeOpKind::Mul && m == 0) {
+                v = _numeral(ev, 0, h[0], a->numeral.x);
+                break;
+            }
+            //n m with n = 0 is \x.x, which is no numeral
+            if (op.kind == NativeOpKind::Exp && m == 0) return _fallback(op, args, op.arity, ev);
+            Value* b = ev.force(args[1 - first]);
+            if (!b) return nullptr;
+            args[1 - first] = b;
+            if (b->type != ValueType::Numeral) return _fallback(op, args, op.arity, ev);
+
+            const Value* l = args[0];
+            const Value* r = args[1];
+            uint64_t x = l->numeral.n;
+            uint64_t y = r->numeral.n;
+            uint64_t out = 0;
+            switch (op.kind) {
+                case NativeOpKind::Add:
+                    if (__builtin_add_overflow(x, y, &out)) return _fallback(op, args, op.arity, ev);
+                    v = _numeral(ev, out, h[0], h[1]);
+                    break;
+                case NativeOpKind::Sub:
+                    v = y == 0 ? args[0] : _numeral(ev, x > y ? x - y : 0, h[0], h[1]);
+                    break;
+                case NativeOpKind::Mul:
+                    if (__builtin_mul_overflow(x, y, &out)) return _fallback(op, args, op.arity, ev);
+                    v = _numeral(ev, out, h[0], l->numeral.x);
+                    break;
+                case NativeOpKind::Exp:
+                    if (!_power(x, y, out)) return _fallback(op, args, op.arity, ev);
+                    v = _numeral(ev, out, r->numeral.x, l->numeral.x);
+                    break;
+                case NativeOpKind::Leq:
+                    v = x <= y ? _boolean(ev, true, h[0], h[1]) : _boolean(ev, false, h[2], h[3]);
+                    break;
+                case NativeOpKind::Eq:
+                    if (x == y) {
+                        v = _boolean(ev, true, h[0], h[1]);
+                    } else {
+                        v = x < y ? _boolean(ev, false, h[2], h[3]) : _boolean(ev, false, h[4], h[5]);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+    }
+    STAT_INC(deltas);
+    return v;
+}
+
+//the operator's own definition applied to the operands, as pure reduction runs it
+Value* Native::_fallback(const NativeOp& op, Value** args, uint32_t count, Evaluator& ev) {
+    Value* v = ev.eval(op.term, ev.empty);
+    for (uint32_t i = 0; i < count && v; i++) v = ev.apply(v, args[i]);
+    return v;
+}
+
+Value* Native::expand(Value* delta, Evaluator& ev) {
+    Value* args[2] = { delta->delta.args[0], delta->delta.args[1] };
+    uint32_t count = args[0] ? (args[1] ? 2 : 1) : 0;
+    return _fallback(*delta->delta.op, args, count, ev);
+}
\ No newline at end of file
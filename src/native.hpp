@@ -0,0 +1,84 @@
+#pragma once
+
+#include "symbol.hpp"
+#include "term.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+struct Evaluator;
+struct Value;
+
+// Native mode of the recursive evaluator. Definitions whose normal form is a
+// Church numeral or boolean evaluate to compact literals, and definitions of
+// the usual arithmetic operators are recognized by the shape of their normal
+// form (binder names aside) and computed directly once their operands are
+// literals. A literal applied anywhere else behaves exactly like the lambda
+// it stands for, and reads back as that lambda.
+//
+// Results are the same terms pure reduction gives, binder names included:
+// each rule takes the names of the binders pure reduction would have left in
+// the result, from the operator's definition or from its operands.
+enum class NativeOpKind : uint8_t {
+    Succ,   //\n.\f.\x.f (n f x)
+    Pred,   //\n.\f.\x.n (\g.\h.h (g f)) (\u.x) (\u.u)
+    IsZero, //\n.n (\x.FALSE) TRUE
+    Add,    //\m.\n.\f.\x.m f (n f x)
+    Sub,    //\m.\n.n PRED m, 0 when n > m
+    Mul,    //\m.\n.\f.m (n f)
+    Exp,    //\m.\n.n m
+    Leq,    //\m.\n.ISZERO (SUB m n)
+    Eq      //\m.\n.AND (LEQ m n) (LEQ n m), with AND = \p.\q.p q p
+};
+
+struct NativeOp {
+    NativeOpKind kind;
+    uint32_t arity;
+    const Term* term;   //the definition, run as is when an operand is not a numeral
+    Symbol hints[6];    //binder names its results take, see _RULES in native.cpp
+};
+
+// Looks up a definition as it was written rather than its normal form.
+using WrittenLookup = const Term* (*)(void* env, const Term* global);
+
+// One evaluation's recognized definitions. Owned by whoever runs the
+// evaluation, and set as EvalContext::native for its duration.
+struct Native {
+    // `written` may be null: definitions then always run normalized. The
+    // constructor builds a term, so the evaluation's factory must be current.
+    Native(WrittenLookup written, void* env);
+    Native(const Native&) = delete;
+    Native& operator=(const Native&) = delete;
+
+    // Value of a reference to `global`, whose definition resolved to `def`.
+    Value* eval_global(const Term* global, const Term* def, Evaluator& ev);
+
+    // Applies a literal or a Delta value.
+    Value* apply(Value* fn, Value* arg, Evaluator& ev);
+
+    // The closure a Delta value stands for.
+    Value* expand(Value* delta, Evaluator& ev);
+
+private:
+    enum class _Kind : uint8_t { None, Numeral, Boolean, Op };
+
+    struct _Shape {
+        _Kind kind = _Kind::None;
+        uint64_t n = 0;                 //Numeral: the number, Boolean: 1 for true
+        Symbol hints[2] = {};           //Numeral, Boolean: the two binders
+        NativeOp op = {};
+        const Term* run = nullptr;      //None: the term to evaluate, once chosen
+    };
+
+    _Shape& _shape(const Term* def);
+    const Term* _run(const Term* global, const Term* def, _Shape& shape, Evaluator& ev);
+    Value* _reduce(const NativeOp& op, Value** args, Evaluator& ev);
+    Value* _fallback(const NativeOp& op, Value** args, uint32_t count, Evaluator& ev);
+    Value* _iterate(Value* fn, Value* x, Evaluator& ev);
+
+    WrittenLookup _written;
+    void* _env;
+    std::unordered_map<const Term*, _Shape> _shapes; //nodes never move, so ops can be pointed to
+    TermPtr _step; //f x, with f bound one binder further out than x
+};
\ No newline at end of file
@@ -0,0 +1,694 @@
+#include "net.hpp"
+#include "stats.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A port is a node's index times four plus its slot. Slot 0 is the principal
+// port, and two nodes connected through their principal ports interact.
+//
+//   Lam      1: body, 2: variable (its occurrences, shared by fans)
+//   App      0: function, 1: argument, 2: result
+//   Fan      1, 2: the two copies of whatever is at 0
+//   Croissant, Bracket
+//            1: whatever is at 0, a level further out or further in
+//   Era      0 only: deletes whatever reaches it
+//   Root     0 only: where the normal form is read from, never interacts
+//
+// Every node but the last two has a level: how many arguments its subterm is
+// nested in. Lamping's oracle uses the levels to tell apart fans that copy
+// different things. Two control nodes (fans, croissants and brackets) of one
+// kind and level cancel out, and otherwise the one with the lower level passes
+// through the other, a croissant lowering the levels it passes and a bracket
+// raising them.
+enum class _Kind : uint8_t {
+    Free,
+    Root,
+    Lam,
+    App,
+    Fan,
+    Croissant,
+    Bracket,
+    Era
+};
+
+using _Port = uint32_t;
+
+constexpr _Port _NO_PORT = UINT32_MAX;
+constexpr uint32_t _MAX_NODES = 1u << 25;
+
+struct _Node {
+    _Port ports[3];
+    uint32_t level;
+    uint32_t hint; //Lam only
+    uint32_t stamp; //bumped whenever the index is reused, to tell a node from its successors
+    _Kind kind;
+};
+
+static uint32_t _node(_Port port) { return port >> 2; }
+static uint32_t _slot(_Port port) { return port & 3; }
+static _Port _port(uint32_t node, uint32_t slot) { return node << 2 | slot; }
+
+static uint32_t _arity(_Kind kind) {
+    switch (kind) {
+        case _Kind::Lam:
+        case _Kind::App:
+        case _Kind::Fan:
+            return 3;
+        case _Kind::Croissant:
+        case _Kind::Bracket:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static bool _control(_Kind kind) {
+    return kind == _Kind::Fan || kind == _Kind::Croissant || kind == _Kind::Bracket;
+}
+
+struct _Net {
+    EvalContext& ctx;
+    std::vector<_Node> nodes;
+    std::vector<uint32_t> free;
+    std::vector<uint32_t> garbage; //erasers linked since the last collect
+    bool full = false;
+
+    //node 0 is never part of the net: once the pool is full, alloc hands it
+    //out instead of a real node, so whatever is linked to it corrupts nothing
+    //the caller then goes on to read
+    explicit _Net(EvalContext& ctx) : ctx(ctx) { nodes.emplace_back().kind = _Kind::Free; }
+
+    uint32_t alloc(_Kind kind, uint32_t level, uint32_t hint = 0) {
+        uint32_t n;
+        if (!free.empty()) {
+            n = free.back();
+            free.pop_back();
+            nodes[n].stamp++;
+        } else {
+            if (nodes.size() >= _MAX_NODES) full = true;
+            n = full ? 0 : (uint32_t)nodes.size();
+            if (!full) {
+                nodes.emplace_back();
+                ctx.held_bytes = nodes.capacity() * sizeof(_Node);
+            }
+        }
+        _Node& node = nodes[n];
+        node.ports[0] = node.ports[1] = node.ports[2] = _NO_PORT;
+        node.level = level;
+        node.hint = hint;
+        node.kind = kind;
+        return n;
+    }
+
+    void release(uint32_t n) {
+        nodes[n].kind = _Kind::Free;
+        free.push_back(n);
+    }
+
+    _Kind kind(_Port port) const { return nodes[_node(port)].kind; }
+    _Port& at(_Port port) { return nodes[_node(port)].ports[_slot(port)]; }
+
+    void link(_Port a, _Port b) {
+        at(a) = b;
+        at(b) = a;
+        if (kind(a) == _Kind::Era) garbage.push_back(_node(a));
+        if (kind(b) == _Kind::Era) garbage.push_back(_node(b));
+    }
+
+    //connects whatever is at `a` to whatever is at `b`, both ports of nodes
+    //about to go. Reading the ends afresh on every call keeps wires that loop
+    //between the two nodes right
+    void relink(_Port a, _Port b) { link(at(a), at(b)); }
+
+    bool interact(uint32_t x, uint32_t y);
+    bool collect();
+    bool reduce(uint32_t root);
+    void duplicate(uint32_t fan, uint32_t other);
+    void pass(uint32_t control, uint32_t other);
+    _Port share(const std::vector<_Port>& uses, uint32_t level);
+    _Port wrap(_Kind kind, uint32_t level, _Port dest);
+};
+
+//Where a value must go to reach every port in `uses`: a chain of fans, or an
+//eraser if there are none
+_Port _Net::share(const std::vector<_Port>& uses, uint32_t level) {
+    if (uses.empty()) return _port(alloc(_Kind::Era, 0), 0);
+    _Port source = uses.back();
+    for (size_t i = uses.size() - 1; i-- > 0;) {
+        uint32_t fan = alloc(_Kind::Fan, level);
+        if (full) break;
+        link(_port(fan, 1), uses[i]);
+        link(_port(fan, 2), source);
+        source = _port(fan, 0);
+    }
+    return source;
+}
+
+//puts a croissant or bracket in front of `dest`, facing away from it
+_Port _Net::wrap(_Kind kind, uint32_t level, _Port dest) {
+    uint32_t n = alloc(kind, level);
+    if (!full) link(_port(n, 1), dest);
+    return _port(n, 0);
+}
+
+//the fan copies `other`, and a fan of its own takes each of the old auxiliary
+//ports' neighbours. Every end is read afresh, as in relink
+void _Net::duplicate(uint32_t fan, uint32_t other) {
+    const _Node& o = nodes[other];
+    _Kind kind = o.kind;
+    uint32_t arity = _arity(kind);
+    uint32_t level = o.level;
+    uint32_t hint = o.hint;
+    uint32_t copies[2] = { alloc(kind, level, hint), alloc(kind, level, hint) };
+    uint32_t fans[3] = {};
+    for (uint32_t slot = 1; slot < arity; slot++) fans[slot] = alloc(_Kind::Fan, nodes[fan].level);
+    if (full) return;
+    for (uint32_t slot = 1; slot < arity; slot++) link(_port(fans[slot], 0), at(_port(other, slot)));
+    link(_port(copies[0], 0), at(_port(fan, 1)));
+    link(_port(copies[1], 0), at(_port(fan, 2)));
+    for (uint32_t slot = 1; slot < arity; slot++) {
+        link(_port(fans[slot], 1), _port(copies[0], slot));
+        link(_port(fans[slot], 2), _port(copies[1], slot));
+    }
+    release(fan);
+    release(other);
+}
+
+//a croissant or bracket moves to the far side of `other`, one copy on each of
+//its auxiliary ports, shifting its level if it is higher
+void _Net::pass(uint32_t control, uint32_t other) {
+    _Kind kind = nodes[control].kind;
+    uint32_t level = nodes[control].level;
+    uint32_t arity = _arity(nodes[other].kind);
+    uint32_t copies[3] = {};
+    for (uint32_t slot = 1; slot < arity; slot++) copies[slot] = alloc(kind, level);
+    if (full) return;
+    for (uint32_t slot = 1; slot < arity; slot++) link(_port(copies[slot], 0), at(_port(other, slot)));
+    link(_port(other, 0), at(_port(control, 1)));
+    for (uint32_t slot = 1; slot < arity; slot++) link(_port(copies[slot], 1), _port(other, slot));
+    uint32_t& shifted = nodes[other].level;
+    if (shifted > level) shifted = kind == _Kind::Croissant ? shifted - 1 : shifted + 1;
+    release(control);
+}
+
+//rewrites one pair of nodes connected through their principal ports
+bool _Net::interact(uint32_t x, uint32_t y) {
+    //the oracle's rewrites can outnumber the betas by far, so every kind counts
+    //against the limits
+    if (!ctx.step()) return false;
+    _Kind kx = nodes[x].kind;
+    _Kind ky = nodes[y].kind;
+    if (kx > ky) {
+        std::swap(x, y);
+        std::swap(kx, ky);
+    }
+
+    if (kx == _Kind::Lam && ky == _Kind::App) {
+        STAT_INC(steps);
+        relink(_port(x, 1), _port(y, 2));
+        relink(_port(x, 2), _port(y, 1));
+        release(x);
+        release(y);
+    } else if (kx == _Kind::Era && ky == _Kind::Era) {
+        release(x);
+        release(y);
+    } else if (ky == _Kind::Era) {
+        uint32_t erasers[3] = {};
+        for (uint32_t slot = 1; slot < _arity(kx); slot++) erasers[slot] = alloc(_Kind::Era, 0);
+        if (full) return false;
+        for (uint32_t slot = 1; slot < _arity(kx); slot++) link(_port(erasers[slot], 0), at(_port(x, slot)));
+        release(x);
+        release(y);
+    } else if (!_control(ky)) {
+        ctx.error = "malformed net";
+        return false;
+    } else if (!_control(kx)) {
+        if (ky == _Kind::Fan) {
+            duplicate(y, x);
+        } else {
+            pass(y, x);
+        }
+    } else if (nodes[x].level == nodes[y].level) {
+        if (kx != ky) {
+            ctx.error = "malformed net";
+            return false;
+        }
+        for (uint32_t slot = 1; slot < _arity(kx); slot++) relink(_port(x, slot), _port(y, slot));
+        release(x);
+        release(y);
+    } else {
+        uint32_t lower = nodes[x].level < nodes[y].level ? x : y;
+        uint32_t upper = lower == x ? y : x;
+        if (nodes[lower].kind == _Kind::Fan) {
+            duplicate(lower, upper);
+        } else {
+            pass(lower, upper);
+        }
+    }
+    return !full;
+}
+
+//Erasing is done as soon as an eraser is linked rather than when the walk
+//below gets to it, since that may be never: the walk only follows wires that
+//lead to the root. Besides what an eraser meets through its principal port,
+//an application whose result is erased goes, and so do a croissant or bracket
+//whose far side is erased and a fan whose copies both are
+bool _Net::collect() {
+    while (!garbage.empty()) {
+        uint32_t era = garbage.back();
+        garbage.pop_back();
+        if (nodes[era].kind != _Kind::Era) continue;
+        _Port to = nodes[era].ports[0];
+        uint32_t n = _node(to);
+        _Kind k = nodes[n].kind;
+        if (k == _Kind::Root) continue;
+        if (_slot(to) == 0) {
+            if (!interact(era, n)) return false;
+        } else if (k == _Kind::App && _slot(to) == 2) {
+            uint32_t other = alloc(_Kind::Era, 0);
+            if (full) return false;
+            link(_port(era, 0), at(_port(n, 0)));
+            link(_port(other, 0), at(_port(n, 1)));
+            release(n);
+        } else if (k == _Kind::Croissant || k == _Kind::Bracket) {
+            link(_port(era, 0), at(_port(n, 0)));
+            release(n);
+        } else if (k == _Kind::Fan && kind(at(_port(n, 3 - _slot(to)))) == _Kind::Era) {
+            release(_node(at(_port(n, 3 - _slot(to)))));
+            link(_port(era, 0), at(_port(n, 0)));
+            release(n);
+        }
+    }
+    return true;
+}
+
+//Only pairs the normal form depends on are rewritten, so a shared part that
+//ends up erased is never copied. The walk starts at the root: from a port
+//reached through a wire's auxiliary end it heads for the node's principal
+//port, rewriting the pair found there if there is one, and from a principal
+//port it goes on through each auxiliary port in turn. The way up is kept as
+//the ports it came through, so after a rewrite the walk picks up again at the
+//nearest of them the rewrite left in place rather than at the root
+bool _Net::reduce(uint32_t root) {
+    //a port, and the stamp its node had when the walk passed it
+    struct Mark {
+        _Port port;
+        uint32_t stamp;
+    };
+    auto mark = [&](_Port port) { return Mark{ port, nodes[_node(port)].stamp }; };
+    auto alive = [&](const Mark& m) {
+        const _Node& node = nodes[_node(m.port)];
+        return node.kind != _Kind::Free && node.stamp == m.stamp;
+    };
+
+    std::vector<Mark> later;    //auxiliary ports still to go through
+    std::vector<Mark> path;     //per node on the way up, the port it was entered from
+    bool ok = !full && collect();
+    _Port next = at(_port(root, 0));
+    while (ok) {
+        if (!ctx.tick()) {
+            ok = false;
+            break;
+        }
+        if (next == _NO_PORT) {
+            path.clear();
+            if (later.empty()) break;
+            Mark from = later.back();
+            later.pop_back();
+            if (alive(from)) {
+                path.push_back(from);
+                next = at(from.port);
+            }
+            continue;
+        }
+        uint32_t n = _node(next);
+        _Kind k = nodes[n].kind;
+        _Port prev = at(next);
+        if (k == _Kind::Root) {
+            next = _NO_PORT;
+        } else if (_slot(next) == 0 && _slot(prev) == 0 && kind(prev) != _Kind::Root) {
+            ok = interact(n, _node(prev)) && collect();
+            if (!ok) break;
+            _Port back = _port(root, 0);
+            while (!path.empty()) {
+                Mark m = path.back();
+                path.pop_back();
+                if (alive(m)) {
+                    back = m.port;
+                    break;
+                }
+            }
+            next = at(back);
+        } else if (_slot(next) == 0) {
+            uint32_t arity = _arity(k);
+            if (arity > 2) later.push_back(mark(_port(n, 2)));
+            next = arity > 1 ? at(_port(n, 1)) : _NO_PORT;
+        } else {
+            path.push_back(mark(prev));
+            next = at(_port(n, 0));
+        }
+    }
+    if (full) {
+        ctx.error = "net grew past its node limit";
+        return false;
+    }
+    return ok;
+}
+
+//every definition `term` reaches, ordered so a definition comes after every
+//one that refers to it, or false if one refers to itself
+static bool _definitions(const Term* term, EvalContext& ctx, std::vector<const Term*>& order) {
+    using namespace std::string_literals;
+
+    enum { Open, Done };
+    std::unordered_map<const Term*, int> state;
+    std::vector<std::pair<const Term*, bool>> pending; //definition, its references pushed
+    std::vector<const Term*> postorder;
+
+    auto refs = [&](const Term* t, std::vector<const Term*>& out) -> bool {
+        std::vector<const Term*> walk;
+        std::unordered_map<const Term*, bool> seen;
+        walk.push_back(t);
+        while (!walk.empty()) {
+            const Term* n = walk.back();
+            walk.pop_back();
+            if (!seen.emplace(n, true).second) continue;
+            if (n->type == TermType::Lam) {
+                walk.push_back(n->lam.body);
+            } else if (n->type == TermType::App) {
+                walk.push_back(n->app.lhs);
+                walk.push_back(n->app.rhs);
+            } else if (n->type == TermType::Global) {
+                const Term* def = ctx.resolve(n);
+                if (!def) {
+                    ctx.error = "variable "s + symbol_cstr(n->global.id) + " is not assigned";
+                    return false;
+                }
+                out.push_back(def);
+            }
+        }
+        return true;
+    };
+
+    std::vector<const Term*> roots;
+    if (!refs(term, roots)) return false;
+    for (const Term* root : roots) pending.push_back({ root, false });
+    while (!pending.empty()) {
+        auto [def, expanded] = pending.back();
+        pending.pop_back();
+        auto it = state.find(def);
+        if (expanded) {
+            it->second = Done;
+            postorder.push_back(def);
+            continue;
+        }
+        if (it != state.end()) {
+            if (it->second == Open) {
+                ctx.error = "the net backend cannot share a recursive definition";
+                return false;
+            }
+            continue;
+        }
+        state[def] = Open;
+        pending.push_back({ def, true });
+        std::vector<const Term*> deps;
+        if (!refs(def, deps)) return false;
+        for (const Term* dep : deps) pending.push_back({ dep, false });
+    }
+    order.assign(postorder.rbegin(), postorder.rend());
+    return true;
+}
+
+//links the value of `term`, at `level`, to `dest`, recording where
+//definitions are used. An occurrence of a variable reaches its binder through
+//a croissant at its own level, then a bracket for each argument it is inside
+//of that the binder is not; definitions are bound at level 0
+static void _build(_Net& net, const Term* term, uint32_t level, _Port dest,
+    std::unordered_map<const Term*, std::vector<_Port>>& uses) {
+    struct Work {
+        const Term* term; //nullptr: close the innermost binder
+        uint32_t level;
+        _Port dest;
+    };
+    auto occurrence = [&](uint32_t level, uint32_t bound, _Port dest) {
+        _Port port = net.wrap(_Kind::Croissant, level, dest);
+        while (level-- > bound) port = net.wrap(_Kind::Bracket, level, port);
+        return port;
+    };
+    std::vector<Work> pending;
+    std::vector<uint32_t> binders;
+    std::unordered_map<uint32_t, std::vector<_Port>> vars; //per Lam node, its occurrences
+    pending.push_back({ term, level, dest });
+    while (!pending.empty() && !net.full) {
+        Work w = pending.back();
+        pending.pop_back();
+        if (!w.term) {
+            uint32_t lam = binders.back();
+            binders.pop_back();
+            auto it = vars.find(lam);
+            _Port source = net.share(it == vars.end() ? std::vector<_Port>() : it->second, net.nodes[lam].level);
+            net.link(_port(lam, 2), source);
+            if (it != vars.end()) vars.erase(it);
+            continue;
+        }
+        switch (w.term->type) {
+            case TermType::Var: {
+                uint32_t lam = binders[binders.size() - 1 - w.term->index];
+                vars[lam].push_back(occurrence(w.level, net.nodes[lam].level, w.dest));
+                break;
+            }
+            case TermType::Lam: {
+                uint32_t lam = net.alloc(_Kind::Lam, w.level, w.term->lam.hint);
+                if (net.full) break;
+                net.link(_port(lam, 0), w.dest);
+                binders.push_back(lam);
+                pending.push_back({ nullptr, 0, 0 });
+                pending.push_back({ w.term->lam.body, w.level, _port(lam, 1) });
+                break;
+            }
+            case TermType::App: {
+                uint32_t app = net.alloc(_Kind::App, w.level);
+                if (net.full) break;
+                net.link(_port(app, 2), w.dest);
+                pending.push_back({ w.term->app.rhs, w.level + 1, _port(app, 1) });
+                pending.push_back({ w.term->app.lhs, w.level, _port(app, 0) });
+                break;
+            }
+            case TermType::Global:
+                uses[net.ctx.resolve(w.term)].push_back(occurrence(w.level, 0, w.dest));
+                break;
+        }
+    }
+}
+
+//Follows wires from `port` keeping the context Lamping's read-back needs: a
+//stack of fan copies per level. Entering a fan through a copy pushes which
+//copy on its level's stack, and entering it from the shared side pops the copy
+//to leave through. A croissant passed towards its principal port opens an
+//empty level at its own, shifting the ones above up, and a bracket folds the
+//level above its own into its own; passed the other way they undo that
+struct _NetReadBack {
+    struct Cell {
+        uint32_t slot; //1, 2: a fan copy on top of `rest`, 0: a folded pair
+        uint32_t rest;
+        uint32_t folded;
+    };
+
+    //a lambda the read-back is under. Below its own level, the context it
+    //was entered with tells which of the lambda's instances this is
+    struct Binder {
+        uint32_t node;
+        std::vector<uint32_t> instance;
+    };
+
+    _Net& net;
+    std::vector<Cell> cells;        //0 is the empty stack, equal stacks are one cell
+    std::unordered_map<uint64_t, uint32_t> interned;
+    std::vector<uint32_t> levels;   //levels past the end are empty
+    std::vector<std::vector<uint32_t>> saved;
+    std::vector<Binder> binders;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> depth; //Lam node to its places in binders
+
+    explicit _NetReadBack(_Net& net) : net(net) { cells.push_back({}); }
+
+    std::vector<uint32_t> instance(uint32_t level) const {
+        std::vector<uint32_t> prefix(level);
+        for (uint32_t i = 0; i < level; i++) prefix[i] = get(i);
+        return prefix;
+    }
+
+    uint32_t get(uint32_t level) const { return level < levels.size() ? levels[level] : 0; }
+
+    void set(uint32_t level, uint32_t stack) {
+        if (level >= levels.size()) {
+            if (!stack) return;
+            levels.resize(level + 1, 0);
+        }
+        levels[level] = stack;
+    }
+
+    void insert(uint32_t level, uint32_t stack) {
+        if (level >= levels.size()) return set(level, stack);
+        levels.insert(levels.begin() + level, stack);
+    }
+
+    void erase(uint32_t level) {
+        if (level < levels.size()) levels.erase(levels.begin() + level);
+    }
+
+    uint32_t cell(uint32_t slot, uint32_t rest, uint32_t folded) {
+        uint64_t key = (uint64_t)rest << 32 | (slot ? slot : (uint64_t)folded << 2);
+        auto [it, added] = interned.emplace(key, (uint32_t)cells.size());
+        if (added) cells.push_back({ slot, rest, folded });
+        return it->second;
+    }
+
+    //the port the next term starts at, or _NO_PORT if the net cannot be read
+    _Port walk(_Port port) {
+        size_t limit = net.nodes.size() * 64 + 64;
+        for (size_t guard = 0; guard < limit; guard++) {
+            _Port at = net.at(port);
+            uint32_t n = _node(at);
+            const _Node& node = net.nodes[n];
+            bool in = _slot(at) != 0; //towards the principal port
+            switch (node.kind) {
+                case _Kind::Fan:
+                    if (in) {
+                        set(node.level, cell(_slot(at), get(node.level), 0));
+                        port = _port(n, 0);
+                    } else {
+                        uint32_t top = get(node.level);
+                        if (!top || !cells[top].slot) return _NO_PORT;
+                        set(node.level, cells[top].rest);
+                        port = _port(n, cells[top].slot);
+                    }
+                    continue;
+                case _Kind::Croissant:
+                    if (in) {
+                        insert(node.level, 0);
+                    } else {
+                        erase(node.level);
+                    }
+                    port = _port(n, in ? 0 : 1);
+                    continue;
+                case _Kind::Bracket:
+                    if (in) {
+                        uint32_t low = get(node.level);
+                        uint32_t high = get(node.level + 1);
+                        erase(node.level + 1);
+                        set(node.level, low || high ? cell(0, low, high) : 0);
+                    } else {
+                        uint32_t top = get(node.level);
+                        if (top && cells[top].slot) return _NO_PORT;
+                        set(node.level, top ? cells[top].rest : 0);
+                        insert(node.level + 1, top ? cells[top].folded : 0);
+                    }
+                    port = _port(n, in ? 0 : 1);
+                    continue;
+                default:
+                    return at;
+            }
+        }
+        return _NO_PORT;
+    }
+
+    Term* run(uint32_t root);
+};
+
+Term* _NetReadBack::run(uint32_t root) {
+    enum class Op : uint8_t { Visit, Lam, App, Restore };
+    struct Work {
+        Op op;
+        uint32_t value; //Visit: port, Lam: node
+    };
+    std::vector<Work> pending;
+    std::vector<Term*> built;
+    pending.push_back({ Op::Visit, _port(root, 0) });
+    bool ok = true;
+    while (ok && !pending.empty()) {
+        Work w = pending.back();
+        pending.pop_back();
+        switch (w.op) {
+            case Op::Visit: {
+                _Port at = walk(w.value);
+                if (at == _NO_PORT) {
+                    ok = false;
+                    break;
+                }
+                uint32_t n = _node(at);
+                _Kind kind = net.nodes[n].kind;
+                if (kind == _Kind::Lam && _slot(at) == 0) {
+                    depth[n].push_back((uint32_t)binders.size());
+                    binders.push_back({ n, instance(net.nodes[n].level) });
+                    pending.push_back({ Op::Lam, n });
+                    pending.push_back({ Op::Visit, _port(n, 1) });
+                } else if (kind == _Kind::Lam && _slot(at) == 2) {
+                    auto it = depth.find(n);
+                    std::vector<uint32_t> here = instance(net.nodes[n].level);
+                    size_t i = it == depth.end() ? 0 : it->second.size();
+                    while (i > 0 && binders[it->second[i - 1]].instance != here) i--;
+                    ok = i > 0;
+                    if (ok) built.push_back(term_var((uint32_t)binders.size() - 1 - it->second[i - 1]));
+                } else if (kind == _Kind::App && _slot(at) == 2) {
+                    saved.push_back(levels);
+                    pending.push_back({ Op::App, 0 });
+                    pending.push_back({ Op::Visit, _port(n, 1) });
+                    pending.push_back({ Op::Restore, 0 });
+                    pending.push_back({ Op::Visit, _port(n, 0) });
+                } else {
+                    ok = false;
+                }
+                break;
+            }
+            case Op::Lam: {
+                binders.pop_back();
+                depth[w.value].pop_back();
+                Term* body = built.back();
+                built.back() = term_lam(net.nodes[w.value].hint, body);
+                break;
+            }
+            case Op::App: {
+                Term* arg = built.back();
+                built.pop_back();
+                built.back() = term_app(built.back(), arg);
+                break;
+            }
+            case Op::Restore:
+                levels = std::move(saved.back());
+                saved.pop_back();
+                break;
+        }
+    }
+    if (!ok) {
+        for (Term* t : built) term_release(t);
+        net.ctx.error = "the net's normal form does not read back as a term";
+        return nullptr;
+    }
+    return built.back();
+}
+
+Term* net_normalize_term(const Term* term, EvalContext& ctx) {
+    std::vector<const Term*> order;
+    if (!_definitions(term, ctx, order)) return nullptr;
+
+    _Net net(ctx);
+    uint32_t root = net.alloc(_Kind::Root, 0);
+    std::unordered_map<const Term*, std::vector<_Port>> uses;
+    _build(net, term, 0, _port(root, 0), uses);
+
+    //a definition is an argument the whole term is applied to, so it sits a
+    //level deeper. Every use of it is known by the time it is built, since
+    //everything referring to it came first
+    for (const Term* def : order) {
+        if (net.full) break;
+        _Port source = net.share(uses[def], 0);
+        if (!net.full) _build(net, def, 1, source, uses);
+    }
+
+    if (!net.reduce(root)) return nullptr;
+    _NetReadBack read(net);
+    return read.run(root);
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "eval.hpp"
+
+// Same contract as normalize_term, but reduces an interaction net built from
+// the term instead of substituting into it: Lamping's optimal reduction.
+// Lambdas, applications, erasers, fans and the croissants and brackets of the
+// oracle are nodes in one flat pool, and reduction rewrites one connected pair
+// of nodes at a time, so a shared subterm is reduced once however many copies
+// of it the result needs. Definitions the term reaches are shared the same
+// way, and a recursive one is rejected.
+//
+// Only pairs the normal form depends on are rewritten. Betas are never
+// repeated, but the oracle's own rewrites can outnumber them by far, so this
+// pays off for terms whose cost under the other backends is copying work
+// rather than doing it. `ctx.lazy` is ignored, and `ctx.max_steps` limits
+// interactions of every kind, not only betas; `ctx.max_bytes` counts the node
+// pool.
+Term* net_normalize_term(const Term* term, EvalContext& ctx);
\ No newline at end of file
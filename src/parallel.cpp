@@ -0,0 +1,345 @@
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "value.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+static std::atomic<size_t> _tasks = 0;
+static std::atomic<size_t> _steals = 0;
+
+ParallelStats get_parallel_stats() {
+    ParallelStats stats;
+    stats.tasks = _tasks.load(std::memory_order_relaxed);
+    stats.steals = _steals.load(std::memory_order_relaxed);
+    return stats;
+}
+
+//state shared by every task of one normalization
+struct _Shared {
+    const EvalContext& ctx;
+    size_t threshold;
+    ThreadPool* pool;   //nullptr when running on one thread
+    TaskGroup* group;   //the read-back's tasks, nullptr when running on one thread
+    Arena* target;      //where the result goes, nullptr for the heap
+
+    std::atomic<bool> failed = false;
+    std::mutex lock;
+    std::string error;
+    uint64_t steps = 0;
+    StepPool step_pool; //the step limit, taken in batches
+    std::vector<std::unique_ptr<Arena>> outputs;
+    std::vector<std::unique_ptr<Arena>> values; //later tasks may still read the values of finished ones
+
+    _Shared(const EvalContext& ctx, size_t threshold, ThreadPool* pool, TaskGroup* group, Arena* target)
+        : ctx(ctx), threshold(threshold), pool(pool), group(group), target(target) {
+        step_pool.left = ctx.max_steps - ctx.steps;
+    }
+};
+
+//sets up `ctx` for one part of the normalization, evaluating into `values` on
+//this thread. Evaluation is never lazy: shared thunks would be forced by
+//several tasks at once
+static void _enter(_Shared& shared, EvalContext& ctx, const Arena* values) {
+    ctx.lookup = shared.ctx.lookup;
+    ctx.env = shared.ctx.env;
+    //every part draws on what is left of the one limit
+    if (shared.ctx.max_steps) ctx.step_pool = &shared.step_pool;
+    ctx.deadline = shared.ctx.deadline;
+    ctx.cancelled = shared.ctx.cancelled;
+    ctx.abandoned = &shared.failed;
+    ctx.max_bytes = shared.ctx.max_bytes;
+    ctx.start(values);
+}
+
+//keeps the first error, which stops every other part
+static void _fail(_Shared& shared, const EvalContext& ctx) {
+    if (ctx.error.empty()) return;
+    std::lock_guard<std::mutex> guard(shared.lock);
+    if (shared.failed.load(std::memory_order_relaxed)) return;
+    shared.error = ctx.error;
+    shared.failed.store(true, std::memory_order_relaxed);
+}
+
+//adds what a part used to the totals. A task hands over the arenas it
+//allocated, which must outlive it
+static void _leave(_Shared& shared, EvalContext& ctx, std::unique_ptr<Arena> values, std::unique_ptr<Arena> output) {
+    //a task's counts must be in the totals before the group's wait returns
+    if (values) stats_flush();
+    ctx.return_steps();
+    _fail(shared, ctx);
+
+    std::lock_guard<std::mutex> guard(shared.lock);
+    shared.steps += ctx.steps;
+    if (values) shared.values.push_back(std::move(values));
+    if (output) shared.outputs.push_back(std::move(output));
+}
+
+static void _eval_task(_Shared& shared, const Term* term, unsigned depth, Symbol centre, Value** out);
+
+//evaluates the closed `term` like ev.eval, handing the arguments of its
+//applications, and of the definitions of globals at their head, to the pool
+//while `depth` lasts
+static Value* _eval(_Shared& shared, Evaluator& ev, const Term* term, unsigned depth) {
+    if (!shared.pool || depth == 0) return ev.eval(term, ev.empty);
+    if (term->type == TermType::Global) {
+        const Term* def = ev.ctx.resolve(term);
+        if (!def || def->type != TermType::App) return ev.eval(term, ev.empty);
+        stat_enter_global(term->global.id);
+        Symbol caller = stat_centre();
+        stat_set_centre(term->global.id);
+        Value* v = _eval(shared, ev, def, depth);
+        stat_set_centre(caller);
+        return v;
+    }
+    if (term->type != TermType::App) return ev.eval(term, ev.empty);
+
+    //variables and lambdas are not worth a task
+    const Term* rhs = term->app.rhs;
+    Value* arg = nullptr;
+    std::optional<TaskGroup> group;
+    if (rhs->type == TermType::App || rhs->type == TermType::Global) {
+        _tasks.fetch_add(1, std::memory_order_relaxed);
+        group.emplace(*shared.pool);
+        _Shared* s = &shared;
+        Symbol centre = stat_centre();
+        group->spawn([s, rhs, depth, centre, &arg]() { _eval_task(*s, rhs, depth - 1, centre, &arg); });
+    }
+
+    Value* fn = _eval(shared, ev, term->app.lhs, depth - 1);
+    if (group) {
+        //the task stops early if this side failed, and may need the steps
+        //this thread holds to finish
+        if (!fn) _fail(shared, ev.ctx);
+        ev.ctx.return_steps();
+        group->wait();
+    } else if (fn) {
+        arg = _eval(shared, ev, rhs, depth - 1);
+    }
+    //a task's error is in `shared` already
+    if (!fn || !arg) return nullptr;
+    return ev.apply(fn, arg);
+}
+
+static void _eval_task(_Shared& shared, const Term* term, unsigned depth, Symbol centre, Value** out) {
+    std::unique_ptr<Arena> values(new Arena);
+    EvalContext ctx;
+    _enter(shared, ctx, values.get());
+    Evaluator ev(values.get(), ctx);
+    stat_set_centre(centre);
+
+    //a task runs on a worker, where nothing may throw past it
+    try {
+        *out = _eval(shared, ev, term, depth);
+    } catch (const std::bad_alloc&) {
+        ctx.error = "out of memory";
+    }
+    _leave(shared, ctx, std::move(values), nullptr);
+}
+
+struct _ReadBackWork {
+    Value* value; //nullptr: leave the scope of the innermost binder
+    Expr* out;
+};
+
+//rough size of the normal form of `v`, counting at most `budget` nodes. Closure
+//bodies and the definitions of globals they mention count, since reading them
+//back means evaluating them
+static size_t _weight(Value* v, const EvalContext& ctx, size_t budget) {
+    std::vector<const Value*> values;
+    std::vector<const Term*> terms;
+    size_t weight = 0;
+    values.push_back(v);
+    while (weight < budget && (!values.empty() || !terms.empty())) {
+        weight++;
+        if (!terms.empty()) {
+            const Term* t = terms.back();
+            terms.pop_back();
+            if (t->type == TermType::Lam) {
+                terms.push_back(t->lam.body);
+            } else if (t->type == TermType::App) {
+                terms.push_back(t->app.lhs);
+                terms.push_back(t->app.rhs);
+            } else if (t->type == TermType::Global) {
+                const Term* def = ctx.resolve(t);
+                if (def) terms.push_back(def);
+            }
+            continue;
+        }
+
+        const Value* value = values.back();
+        values.pop_back();
+        switch (value->type) {
+            case ValueType::Closure: {
+                terms.push_back(value->closure.body);
+                for (const Env* env = value->closure.env; env->parent && values.size() < budget; env = env->parent) {
+                    values.push_back(env->value);
+                }
+                break;
+            }
+            case ValueType::NApp:
+                values.push_back(value->napp.fn);
+                values.push_back(value->napp.arg);
+                break;
+            case ValueType::Thunk:
+                if (value->thunk.result) values.push_back(value->thunk.result);
+                break;
+            case ValueType::NVar:
+                break;
+            //native literals are made by the recursive backend alone
+            case ValueType::Numeral:
+            case ValueType::NumeralFn:
+            case ValueType::Boolean:
+            case ValueType::BooleanFn:
+            case ValueType::Delta:
+                break;
+        }
+    }
+    return weight;
+}
+
+//`values` is null for tasks, which allocate their own; the caller's part of the
+//read-back writes straight to the current arena
+static void _read_back(_Shared& shared, Arena* values, Value* value, Expr* out, NameScope names) {
+    //values live until the whole read-back is done, a task's output stays in
+    //an arena of its own until the caller takes it over
+    std::unique_ptr<Arena> own_values;
+    std::unique_ptr<Arena> output;
+    if (!values) {
+        own_values.reset(new Arena);
+        values = own_values.get();
+        if (shared.target) output.reset(new Arena);
+    }
+    ArenaScope scope(own_values ? output.get() : shared.target);
+
+    EvalContext ctx;
+    _enter(shared, ctx, values);
+    Evaluator ev(values, ctx);
+
+    //a task runs on a worker, where nothing may throw past it
+    try {
+        std::vector<_ReadBackWork> pending;
+        pending.push_back({ value, out });
+        while (!pending.empty() && ctx.error.empty()) {
+            if (shared.failed.load(std::memory_order_relaxed)) break;
+            _ReadBackWork work = pending.back();
+            pending.pop_back();
+
+            if (!work.value) {
+                names.pop();
+                continue;
+            }
+
+            Value* v = work.value;
+            Expr* expr = work.out;
+            switch (v->type) {
+                case ValueType::Closure: {
+                    Value* var = value_new(values, ValueType::NVar);
+                    var->level = (uint32_t)names.names.size();
+                    Value* body = ev.apply(v, var);
+                    if (!body) break;
+                    expr->_fn.id = names.push(v->closure.hint);
+                    expr->_fn.body = new Expr;
+                    expr->_type = ExprType::Fn;
+                    pending.push_back({ nullptr, nullptr });
+                    pending.push_back({ body, expr->_fn.body });
+                    break;
+                }
+                case ValueType::NVar:
+                    expr->_type = ExprType::Var;
+                    expr->_var = names.names[v->level];
+                    break;
+                case ValueType::Thunk: {
+                    Value* forced = ev.force(v);
+                    if (forced) pending.push_back({ forced, expr });
+                    break;
+                }
+                case ValueType::NApp: {
+                    expr->_app.lhs = new Expr;
+                    expr->_app.rhs = new Expr;
+                    expr->_type = ExprType::App;
+                    Value* arg = v->napp.arg;
+                    Expr* arg_out = expr->_app.rhs;
+                    if (shared.group && _weight(arg, ctx, shared.threshold) >= shared.threshold) {
+                        _tasks.fetch_add(1, std::memory_order_relaxed);
+                        _Shared* s = &shared;
+                        shared.group->spawn([s, arg, arg_out, names]() mutable { _read_back(*s, nullptr, arg, arg_out, std::move(names)); });
+                    } else {
+                        pending.push_back({ arg, arg_out });
+                    }
+                    pending.push_back({ v->napp.fn, expr->_app.lhs });
+                    break;
+                }
+                case ValueType::Numeral:
+                case ValueType::NumeralFn:
+                case ValueType::Boolean:
+                case ValueType::BooleanFn:
+                case ValueType::Delta:
+                    ctx.error = "native values cannot be read back in parallel";
+                    break;
+            }
+        }
+
+    } catch (const std::bad_alloc&) {
+        ctx.error = "out of memory";
+    }
+
+    _leave(shared, ctx, std::move(own_values), std::move(output));
+}
+
+Expr* parallel_normalize(const Term* term, EvalContext& ctx, const ParallelOptions& options) {
+    ThreadPool* pool = nullptr;
+    std::unique_ptr<ThreadPool> own_pool;
+    if (options.threads == 0 || (options.threads > 1 && options.threads == ThreadPool::shared().workers() + 1)) {
+        pool = &ThreadPool::shared();
+    } else if (options.threads > 1) {
+        own_pool.reset(new ThreadPool(options.threads - 1));
+        pool = own_pool.get();
+    }
+    if (pool && pool->workers() == 0) pool = nullptr;
+    size_t steals = pool ? pool->steals() : 0;
+
+    Arena* target = Arena::current();
+    std::optional<TaskGroup> group;
+    if (pool) group.emplace(*pool);
+    _Shared shared(ctx, options.threshold, pool, group ? &*group : nullptr, target);
+
+    //a few evaluation tasks for every thread; how big they are is not known
+    //before they run
+    unsigned depth = 2;
+    for (unsigned n = pool ? pool->workers() + 1 : 0; n; n >>= 1) depth++;
+
+    Arena values;
+    Value* v = nullptr;
+    {
+        EvalContext part;
+        _enter(shared, part, &values);
+        Evaluator ev(&values, part);
+        try {
+            v = _eval(shared, ev, term, depth);
+        } catch (const std::bad_alloc&) {
+            part.error = "out of memory";
+        }
+        _leave(shared, part, nullptr, nullptr);
+    }
+
+    Expr* root = new Expr;
+    if (v) _read_back(shared, &values, v, root, NameScope());
+    if (group) group->wait();
+
+    if (pool) _steals.fetch_add(pool->steals() - steals, std::memory_order_relaxed);
+    ctx.steps += shared.steps;
+    for (std::unique_ptr<Arena>& output : shared.outputs) target->adopt(*output);
+    if (shared.failed) {
+        ctx.error = shared.error;
+        delete root;
+        return nullptr;
+    }
+    return root;
+}
\ No newline at end of file
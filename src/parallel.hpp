@@ -0,0 +1,33 @@
+#pragma once
+
+#include "eval.hpp"
+#include "expr.hpp"
+
+#include <cstddef>
+
+struct ParallelOptions {
+    unsigned threads = 0;       //threads taking part, caller included; 0 is one per hardware thread
+    size_t threshold = 2048;    //estimated size under which a subterm is not worth a task
+};
+
+struct ParallelStats {
+    size_t tasks;   //subterms handed to the pool
+    size_t steals;  //tasks a worker took from another one's queue
+};
+
+ParallelStats get_parallel_stats();
+
+// Same contract as normalize_term, except that the result comes back in named
+// form, allocated like any other Expr. Tasks go to a work-stealing pool in two
+// places. Evaluation is strict and splits off the arguments of the
+// applications in `term`, and in the definitions of globals at their heads, a
+// few levels deep; what those arguments compute is not known before it runs,
+// so the applications built while evaluating them stay on one thread. The
+// read-back splits off the arguments of stuck applications whose estimated
+// size reaches the threshold; smaller terms never leave their thread. The
+// result is identical to normalize_term followed by term_to_expr.
+//
+// `ctx.lookup` is called from several threads and must not modify anything.
+// The step limit covers the evaluation and every task together, and the
+// first task to fail stops the others.
+Expr* parallel_normalize(const Term* term, EvalContext& ctx, const ParallelOptions& options);
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "parser.hpp"
+#include "stats.hpp"
+#include "symbol.hpp"
+
+#include <cctype>
+#include <vector>
+
+static std::string_view _token_name(TokenType type) {
+    using namespace std::string_view_literals;
+
+    switch (type) {
+        case TokenType::Id: return "ID"sv;
+        case TokenType::Assign: return "assign operator"sv;
+        case TokenType::Lambda: return "lambda operator"sv;
+        case TokenType::Period: return "lambda body"sv;
+        case TokenType::ParenL: return "open parenthesis"sv;
+        case TokenType::ParenR: return "close parenthesis"sv;
+        case TokenType::Eol: return "EOL"sv;
+    }
+
+    return "?"sv;
+}
+
+static bool _is_id_char(char c) {
+    switch (c) {
+        case '=':
+        case '(':
+        case ')':
+        case '\\':
+        case '.':
+            return false;
+        default:
+            return !std::isspace((unsigned char)c);
+    }
+}
+
+void Parser::_lex() {
+    STAT_INC(tokens);
+    while (_cursor < _source.size() && std::isspace((unsigned char)_source[_cursor])) _cursor++;
+
+    _token.offset = _cursor;
+    _token.length = 1;
+    if (_cursor == _source.size()) {
+        _token.type = TokenType::Eol;
+        _token.length = 0;
+        return;
+    }
+
+    switch (_source[_cursor]) {
+        case '=': _token.type = TokenType::Assign; break;
+        case '(': _token.type = TokenType::ParenL; break;
+        case ')': _token.type = TokenType::ParenR; break;
+        case '\\': _token.type = TokenType::Lambda; break;
+        case '.': _token.type = TokenType::Period; break;
+        default: {
+            uint32_t end = _cursor + 1;
+            while (end < _source.size() && _is_id_char(_source[end])) end++;
+            _token.type = TokenType::Id;
+            _token.length = end - _cursor;
+            break;
+        }
+    }
+    _cursor += _token.length;
+}
+
+void Parser::_unexpected() {
+    using namespace std::string_literals;
+    _error = "column "s + std::to_string(_token.offset + 1) + ": unexpected "s + std::string(_token_name(_token.type));
+}
+
+bool Parser::_start() {
+    _error.clear();
+    if (_source.size() >= UINT32_MAX) {
+        _error = "expression is too long";
+        return false;
+    }
+    _cursor = 0;
+    _lex();
+    return true;
+}
+
+enum class _FrameType : uint8_t {
+    Top,
+    Paren,
+    Lambda
+};
+
+//an expression being built: the application of everything read so far
+struct Parser::_Frame {
+    _FrameType type;
+    Symbol binder; //Lambda only
+    std::unique_ptr<Expr> expr;
+};
+
+static void _append(std::unique_ptr<Expr>& expr, std::unique_ptr<Expr> next) {
+    if (!expr) {
+        expr = std::move(next);
+        return;
+    }
+    std::unique_ptr<Expr> app(new Expr);
+    app->_type = ExprType::App;
+    app->_app.lhs = expr.release();
+    app->_app.rhs = next.release();
+    expr = std::move(app);
+}
+
+std::unique_ptr<Expr> Parser::_parse() {
+    std::vector<_Frame> frames;
+    frames.push_back({ _FrameType::Top, NO_SYMBOL, nullptr });
+
+    while (true) {
+        switch (_token.type) {
+            case TokenType::Id: {
+                std::unique_ptr<Expr> var(new Expr);
+                var->_type = ExprType::Var;
+                var->_var = intern(_text(_token));
+                _append(frames.back().expr, std::move(var));
+                _lex();
+                break;
+            }
+            case TokenType::Lambda: {
+                _lex();
+                if (_token.type != TokenType::Id) {
+                    _unexpected();
+                    return nullptr;
+                }
+                Symbol binder = intern(_text(_token));
+                _lex();
+                if (_token.type != TokenType::Period) {
+                    _unexpected();
+                    return nullptr;
+                }
+                _lex();
+                frames.push_back({ _FrameType::Lambda, binder, nullptr });
+                break;
+            }
+            case TokenType::ParenL:
+                frames.push_back({ _FrameType::Paren, NO_SYMBOL, nullptr });
+                _lex();
+                break;
+            case TokenType::ParenR:
+            case TokenType::Eol: {
+                //a lambda body runs up to the enclosing parenthesis or the end
+                while (frames.back().type == _FrameType::Lambda) {
+                    _Frame& lambda = frames.back();
+                    if (!lambda.expr) {
+                        _unexpected();
+                        return nullptr;
+                    }
+                    std::unique_ptr<Expr> fn(new Expr);
+                    fn->_type = ExprType::Fn;
+                    fn->_fn.id = lambda.binder;
+                    fn->_fn.body = lambda.expr.release();
+                    frames.pop_back();
+                    _append(frames.back().expr, std::move(fn));
+                }
+
+                _Frame& top = frames.back();
+                bool closes = _token.type == TokenType::ParenR;
+                if (!top.expr || closes != (top.type == _FrameType::Paren)) {
+                    _unexpected();
+                    return nullptr;
+                }
+                if (!closes) return std::move(top.expr);
+
+                std::unique_ptr<Expr> inner = std::move(top.expr);
+                frames.pop_back();
+                _append(frames.back().expr, std::move(inner));
+                _lex();
+                break;
+            }
+            default:
+                _unexpected();
+                return nullptr;
+        }
+    }
+}
+
+std::optional<Instruction> Parser::parse_instruction() {
+    if (!_start()) return std::nullopt;
+
+    std::optional<Instruction> inst = std::make_optional<Instruction>();
+    if (_token.type == TokenType::Id) {
+        Token name = _token;
+        uint32_t cursor = _cursor;
+        _lex();
+        if (_token.type == TokenType::Assign) {
+            inst->assign_to = _text(name);
+            _lex();
+        } else {
+            _token = name;
+            _cursor = cursor;
+        }
+    }
+
+    inst->expr = _parse();
+    if (!inst->expr) return std::nullopt;
+    return inst;
+}
+
+std::unique_ptr<Expr> Parser::parse_expression() {
+    if (!_start()) return nullptr;
+    return _parse();
+}
\ No newline at end of file
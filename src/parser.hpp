@@ -0,0 +1,58 @@
+#pragma once
+
+#include "expr.hpp"
+#include "interp.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+enum class TokenType : uint8_t {
+    Id,
+    Assign,
+    Lambda,
+    Period,
+    ParenL,
+    ParenR,
+    Eol
+};
+
+// A token is a slice of the source; 32-bit offsets keep it at 12 bytes.
+struct Token {
+    uint32_t offset;
+    uint32_t length;
+    TokenType type;
+};
+
+// Lexer and parser in one. Tokens are pulled from the source as the parser
+// needs them and identifiers are interned straight from their slice, so one
+// pass over the text builds the tree without copying any of it. Nesting is
+// tracked on a heap stack, as it is wherever an expression is compiled,
+// copied, printed or freed, so deeply nested input cannot overflow the C++
+// stack before reduction starts. All state lives in the object, so parsers
+// can run on several threads at once.
+struct Parser {
+    explicit Parser(std::string_view source) : _source(source) {}
+
+    std::optional<Instruction> parse_instruction(); //`name = expr` or a bare expression
+    std::unique_ptr<Expr> parse_expression();
+
+    // Why the last parse failed, with the column of the offending token.
+    const std::string& error() const { return _error; }
+
+private:
+    struct _Frame;
+
+    bool _start();
+    void _lex();
+    std::string_view _text(const Token& token) const { return _source.substr(token.offset, token.length); }
+    std::unique_ptr<Expr> _parse();
+    void _unexpected();
+
+    std::string_view _source;
+    uint32_t _cursor = 0;
+    Token _token = {};
+    std::string _error;
+};
\ No newline at end of file
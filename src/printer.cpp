@@ -0,0 +1,158 @@
+#include "printer.hpp"
+#include "symbol.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+using namespace std::string_view_literals;
+
+static constexpr std::string_view _CUT_MARK = "..."sv;
+
+size_t printed_size(const Expr& expr) {
+    size_t size = 0;
+    std::vector<const Expr*> pending;
+    pending.push_back(&expr);
+    while (!pending.empty()) {
+        const Expr* e = pending.back();
+        pending.pop_back();
+        switch (e->_type) {
+            case ExprType::Empty:
+                break;
+            case ExprType::Var:
+                size += symbol_name(e->_var).size();
+                break;
+            case ExprType::Fn:
+                size += 4 + symbol_name(e->_fn.id).size(); //"(\" id "." body ")"
+                pending.push_back(e->_fn.body);
+                break;
+            case ExprType::App:
+                size += 3; //"(" lhs " " rhs ")"
+                pending.push_back(e->_app.rhs);
+                pending.push_back(e->_app.lhs);
+                break;
+        }
+    }
+    return size;
+}
+
+//a pending piece of output: a subtree, or text that closes one
+struct _PrintItem {
+    const Expr* expr; //nullptr: print `text`
+    std::string_view text;
+};
+
+// Feeds the printed form of `expr` to `sink` piece by piece, stopping after
+// `limit` bytes. `sink` returns false to stop early. Returns false if the
+// output was cut or the sink stopped.
+template<typename Sink>
+static bool _print(const Expr& expr, size_t limit, Sink&& sink) {
+    size_t left = limit;
+    auto emit = [&](std::string_view text) {
+        if (text.size() > left) {
+            if (left > 0) sink(text.substr(0, left));
+            left = 0;
+            return false;
+        }
+        left -= text.size();
+        return sink(text);
+    };
+
+    std::vector<_PrintItem> pending;
+    pending.push_back({ &expr, {} });
+    while (!pending.empty()) {
+        _PrintItem item = pending.back();
+        pending.pop_back();
+        if (!item.expr) {
+            if (!emit(item.text)) return false;
+            continue;
+        }
+
+        const Expr* e = item.expr;
+        switch (e->_type) {
+            case ExprType::Empty:
+                break;
+            case ExprType::Var:
+                if (!emit(symbol_name(e->_var))) return false;
+                break;
+            case ExprType::Fn:
+                if (!emit("(\\"sv) || !emit(symbol_name(e->_fn.id)) || !emit("."sv)) return false;
+                pending.push_back({ nullptr, ")"sv });
+                pending.push_back({ e->_fn.body, {} });
+                break;
+            case ExprType::App:
+                if (!emit("("sv)) return false;
+                pending.push_back({ nullptr, ")"sv });
+                pending.push_back({ e->_app.rhs, {} });
+                pending.push_back({ nullptr, " "sv });
+                pending.push_back({ e->_app.lhs, {} });
+                break;
+        }
+    }
+    return true;
+}
+
+bool print_expr(const Expr& expr, std::string& out, size_t limit) {
+    size_t size = printed_size(expr);
+    bool cut = size > limit;
+    size_t start = out.size();
+    out.resize(start + (cut ? limit + _CUT_MARK.size() : size));
+
+    char* cursor = out.data() + start;
+    _print(expr, limit, [&](std::string_view text) {
+        memcpy(cursor, text.data(), text.size());
+        cursor += text.size();
+        return true;
+    });
+    if (cut) memcpy(cursor, _CUT_MARK.data(), _CUT_MARK.size());
+    return !cut;
+}
+
+static bool _write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool print_expr(const Expr& expr, int fd, size_t limit) {
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    char buffer[BUFFER_SIZE];
+    size_t used = 0;
+    bool failed = false;
+
+    auto flush = [&] {
+        if (!failed && !_write_all(fd, buffer, used)) failed = true;
+        used = 0;
+        return !failed;
+    };
+
+    bool complete = _print(expr, limit, [&](std::string_view text) {
+        while (!text.empty()) {
+            if (used == BUFFER_SIZE && !flush()) return false;
+            size_t n = std::min(text.size(), BUFFER_SIZE - used);
+            memcpy(buffer + used, text.data(), n);
+            used += n;
+            text.remove_prefix(n);
+        }
+        return true;
+    });
+    if (!complete && !failed) {
+        for (char c : _CUT_MARK) {
+            if (used == BUFFER_SIZE) flush();
+            buffer[used++] = c;
+        }
+    }
+    flush();
+    return !failed;
+}
\ No newline at end of file
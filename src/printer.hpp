@@ -0,0 +1,24 @@
+#pragma once
+
+#include "expr.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+constexpr size_t NO_PRINT_LIMIT = SIZE_MAX;
+
+// Printers for named terms. They walk the tree with an explicit stack, so
+// results of any depth print, and a limit cuts the output after that many
+// bytes and marks the cut with "...".
+
+// Number of bytes `expr` prints as without a limit.
+size_t printed_size(const Expr& expr);
+
+// Appends the printed form to `out`, growing it once to the final size.
+// Returns false if the output was cut at `limit`.
+bool print_expr(const Expr& expr, std::string& out, size_t limit = NO_PRINT_LIMIT);
+
+// Writes the printed form to a file descriptor through a fixed buffer.
+// Returns false if a write failed, with errno set.
+bool print_expr(const Expr& expr, int fd, size_t limit = NO_PRINT_LIMIT);
\ No newline at end of file
@@ -0,0 +1,374 @@
+#include "server.hpp"
+#include "arena.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//a request line longer than this closes the connection
+static constexpr size_t _MAX_LINE = 1 << 20;
+
+struct _Connection {
+    explicit _Connection(int fd, std::shared_ptr<const Prelude> prelude) : fd(fd), session(std::move(prelude)) {}
+
+    int fd;
+    Session session;                //only touched by the one worker running the connection's request
+    std::string input;              //bytes after the last complete line
+    std::deque<std::string> lines;  //requests waiting for the one running
+    std::string output;             //responses not written yet
+    bool busy = false;              //a request is on the pool
+    bool closing = false;           //no more requests: close once the last response is written
+    std::atomic<bool> cancelled = false; //the client is gone, the running request is wasted work
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t steps = 0;
+};
+
+struct _Done {
+    std::shared_ptr<_Connection> connection;
+    std::string response;
+};
+
+struct _Server {
+    const ServerOptions& options;
+    std::shared_ptr<const Prelude> prelude;
+    int wake[2] = {-1, -1};         //workers and signals write a byte to stop poll() waiting
+    std::mutex lock;
+    std::vector<_Done> done;        //finished requests, under `lock`
+};
+
+static volatile sig_atomic_t _stop = 0;
+static int _signal_fd = -1;
+
+static void _on_signal(int) {
+    _stop = 1;
+    char byte = 0;
+    if (_signal_fd >= 0) (void)!write(_signal_fd, &byte, 1);
+}
+
+static bool _set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+static std::string_view _trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+static std::string_view _next_word(std::string_view& rest) {
+    rest = _trim(rest);
+    size_t end = 0;
+    while (end < rest.size() && rest[end] != ' ' && rest[end] != '\t') end++;
+    std::string_view word = rest.substr(0, end);
+    rest = _trim(rest.substr(end));
+    return word;
+}
+
+static std::string _error(_Connection& c, std::string_view text) {
+    c.errors++;
+    std::string response = "ERROR ";
+    response += text;
+    return response;
+}
+
+static std::string _evaluate(_Connection& c, std::string_view text, const ServerOptions& options) {
+    Arena arena;
+    ArenaScope scope(&arena);
+    std::optional<Expr> expr = c.session.parse_expression(text);
+    if (!expr) return _error(c, c.session.get_error_text());
+    ReduceOptions reduce = options.reduce;
+    reduce.cancelled = &c.cancelled;
+    if (!reduce.timeout_ms) reduce.timeout_ms = options.timeout_ms;
+    if (!reduce.max_bytes) reduce.max_bytes = options.max_bytes;
+    bool reduced;
+    {
+        QueryStats stats;
+        reduced = c.session.reduce_in_place(std::move(*expr), reduce);
+    }
+    c.steps += last_query_stats().steps;
+    if (!reduced) return _error(c, c.session.get_error_text());
+    std::string response = "OK ";
+    print_expr(*expr, response, options.limit);
+    return response;
+}
+
+static std::string _stats(_Connection& c) {
+    char text[256];
+    snprintf(text, sizeof(text), "OK requests %llu, errors %llu, steps %llu",
+        (unsigned long long)c.requests, (unsigned long long)c.errors, (unsigned long long)c.steps);
+    std::string response = text;
+    if (stats_enabled()) {
+        ReductionStats total = get_stats();
+        snprintf(text, sizeof(text), "; server queries %llu, steps %llu, eval %.3f ms",
+            (unsigned long long)total.queries, (unsigned long long)total.steps, total.eval_ns / 1e6);
+        response += text;
+    }
+    return response;
+}
+
+//runs on a worker
+static std::string _handle(_Connection& c, std::string_view line, const ServerOptions& options) {
+    c.requests++;
+    std::string_view rest = line;
+    std::string_view request = _next_word(rest);
+    if (request == "evaluate") {
+        if (rest.empty()) return _error(c, "usage: evaluate <expression>");
+        return _evaluate(c, rest, options);
+    }
+    if (request == "define") {
+        std::string name(_next_word(rest));
+        if (name.empty() || rest.empty()) return _error(c, "usage: define <name> <expression>");
+        if (!c.session.set_variable(name.c_str(), std::string(rest).c_str())) return _error(c, c.session.get_error_text());
+        return "OK";
+    }
+    if (request == "clear") {
+        std::string name(_next_word(rest));
+        if (!rest.empty()) return _error(c, "usage: clear [<name>]");
+        if (name.empty()) {
+            c.session.clear_variables();
+        } else if (!c.session.clear_variable(name.c_str())) {
+            return _error(c, c.session.get_error_text());
+        }
+        return "OK";
+    }
+    if (request == "stats" && rest.empty()) return _stats(c);
+    return _error(c, "unknown request, expected define, evaluate, clear or stats");
+}
+
+//hands the connection's next request to the pool unless one is running
+static void _dispatch(_Server& server, TaskGroup& tasks, const std::shared_ptr<_Connection>& connection) {
+    if (connection->busy || connection->lines.empty()) return;
+    connection->busy = true;
+    std::string line = std::move(connection->lines.front());
+    connection->lines.pop_front();
+    tasks.spawn([&server, connection, line = std::move(line)] {
+        std::string response = _handle(*connection, line, server.options);
+        //a response is one line
+        std::replace(response.begin(), response.end(), '\n', ' ');
+        response += '\n';
+        {
+            std::lock_guard<std::mutex> guard(server.lock);
+            server.done.push_back({connection, std::move(response)});
+        }
+        char byte = 0;
+        (void)!write(server.wake[1], &byte, 1);
+    });
+}
+
+//reads what the client sent and queues every complete line
+static void _read(_Connection& c) {
+    char buffer[65536];
+    while (true) {
+        ssize_t n = read(c.fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            c.closing = true;
+            break;
+        }
+        c.input.append(buffer, (size_t)n);
+    }
+
+    size_t start = 0;
+    while (true) {
+        size_t end = c.input.find('\n', start);
+        if (end == std::string::npos) break;
+        std::string_view line = _trim(std::string_view(c.input).substr(start, end - start));
+        if (!line.empty()) c.lines.emplace_back(line);
+        start = end + 1;
+    }
+    c.input.erase(0, start);
+    if (c.input.size() > _MAX_LINE) {
+        c.output += "ERROR request too long\n";
+        c.input.clear();
+        c.closing = true;
+    }
+}
+
+//false once the client can no longer be written to
+static bool _write(_Connection& c) {
+    size_t written = 0;
+    while (written < c.output.size()) {
+        ssize_t n = send(c.fd, c.output.data() + written, c.output.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return false;
+        written += (size_t)n;
+    }
+    c.output.erase(0, written);
+    return true;
+}
+
+static int _listen(const char* path, std::string& error) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        error = "socket path too long";
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    //a socket left behind by a server that did not shut down is taken over
+    struct stat info;
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || !_set_nonblocking(fd) || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+        error = std::string("cannot listen on ") + path + ": " + strerror(errno);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool run_server(const ServerOptions& options, std::shared_ptr<const Prelude> prelude, std::string& error) {
+    if (!options.timeout_ms && !options.reduce.timeout_ms) {
+        error = "evaluations need a time limit";
+        return false;
+    }
+    if (!options.max_bytes && !options.reduce.max_bytes) {
+        error = "evaluations need a memory limit";
+        return false;
+    }
+    _Server server{options, std::move(prelude), {-1, -1}, {}, {}};
+    if (pipe(server.wake) != 0 || !_set_nonblocking(server.wake[0]) || !_set_nonblocking(server.wake[1])) {
+        error = std::string("cannot create pipe: ") + strerror(errno);
+        return false;
+    }
+    int listener = _listen(options.path, error);
+    if (listener < 0) {
+        close(server.wake[0]);
+        close(server.wake[1]);
+        return false;
+    }
+
+    _stop = 0;
+    _signal_fd = server.wake[1];
+    struct sigaction action = {};
+    action.sa_handler = _on_signal;
+    struct sigaction old_int, old_term;
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+
+    //more workers than cores still lets a short request through while long ones run
+    unsigned workers = options.workers ? options.workers : std::max(4u, std::thread::hardware_concurrency());
+    std::vector<std::shared_ptr<_Connection>> connections;
+    {
+        ThreadPool pool(workers);
+        TaskGroup tasks(pool);
+        std::vector<pollfd> fds;
+        while (!_stop) {
+            fds.clear();
+            fds.push_back({server.wake[0], POLLIN, 0});
+            fds.push_back({listener, POLLIN, 0});
+            for (auto& c : connections) {
+                short events = c->closing ? 0 : POLLIN;
+                if (!c->output.empty()) events |= POLLOUT;
+                //a hung up socket reports POLLHUP whatever it is asked for, so one is only watched for it
+                //while that can still cancel something
+                bool watch = events || (c->busy && !c->cancelled.load(std::memory_order_relaxed));
+                fds.push_back({watch ? c->fd : -1, events, 0});
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                error = std::string("poll failed: ") + strerror(errno);
+                break;
+            }
+
+            //connections accepted below have no pollfd yet
+            size_t polled = connections.size();
+            for (size_t i = 0; i < polled; i++) {
+                _Connection& c = *connections[i];
+                short events = fds[i + 2].revents;
+                if ((events & (POLLIN | POLLHUP)) && !c.closing) _read(c);
+                if (events & (POLLHUP | POLLERR)) {
+                    //the client is gone for good, not just done sending: nothing it asked for is worth finishing
+                    c.cancelled.store(true, std::memory_order_relaxed);
+                    c.closing = true;
+                    c.lines.clear();
+                }
+                _dispatch(server, tasks, connections[i]);
+            }
+
+            if (fds[0].revents & POLLIN) {
+                char drain[256];
+                while (read(server.wake[0], drain, sizeof(drain)) > 0) {}
+                std::vector<_Done> done;
+                {
+                    std::lock_guard<std::mutex> guard(server.lock);
+                    done.swap(server.done);
+                }
+                for (_Done& d : done) {
+                    d.connection->busy = false;
+                    d.connection->output += d.response;
+                    _dispatch(server, tasks, d.connection);
+                }
+            }
+
+            if (fds[1].revents & POLLIN) {
+                while (true) {
+                    int fd = accept(listener, nullptr, nullptr);
+                    if (fd < 0) break;
+                    if (!_set_nonblocking(fd)) {
+                        close(fd);
+                        continue;
+                    }
+                    connections.push_back(std::make_shared<_Connection>(fd, server.prelude));
+                }
+            }
+
+            //write what is ready and drop connections that are finished
+            size_t kept = 0;
+            for (size_t i = 0; i < connections.size(); i++) {
+                _Connection& c = *connections[i];
+                bool alive = _write(c);
+                bool finished = c.closing && !c.busy && (c.lines.empty() || !alive) && c.output.empty();
+                if (!alive || finished) {
+                    //a running request keeps the connection, but its response goes nowhere
+                    c.cancelled.store(true, std::memory_order_relaxed);
+                    c.closing = true;
+                    c.lines.clear();
+                    c.output.clear();
+                    close(c.fd);
+                    c.fd = -1;
+                    continue;
+                }
+                connections[kept++] = std::move(connections[i]);
+            }
+            connections.resize(kept);
+        }
+        //the group waits for running requests before the pool goes away
+        for (auto& c : connections) c->cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    for (auto& c : connections) close(c->fd);
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGTERM, &old_term, nullptr);
+    _signal_fd = -1;
+    close(listener);
+    unlink(options.path);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    return error.empty();
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "interp.hpp"
+#include "printer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Serves sessions over a Unix domain socket, one per connection, each built on
+// the same prelude. Clients send one request per line and get one line back,
+// starting with OK or ERROR:
+//
+//   define <name> <expression>   assigns a name in the connection's session
+//   evaluate <expression>        OK and the normal form
+//   clear [<name>]               drops one definition, or all of them
+//   stats                        counters of the connection and the process
+//
+// A single thread accepts connections and moves bytes; requests run on a pool
+// of workers, one at a time per connection and in the order they arrived.
+// Every evaluation runs under the limits in `reduce`, and under `timeout_ms`
+// and `max_bytes` where those set none, so a slow or greedy query holds one
+// worker for a bounded time and memory and never stalls the loop or takes the
+// process down, and one whose client hangs up is cancelled.
+struct ServerOptions {
+    const char* path = nullptr;
+    unsigned workers = 0;           //0: one per hardware thread, and at least four
+    size_t limit = NO_PRINT_LIMIT;  //normal forms are cut after this many bytes
+    uint64_t timeout_ms = 10000;    //run_server refuses 0 unless `reduce` sets a time limit
+    size_t max_bytes = 256 << 20;   //likewise for the memory limit
+    ReduceOptions reduce;
+};
+
+// Runs until SIGINT or SIGTERM, then removes the socket file. Returns false
+// with `error` set if the socket cannot be set up.
+bool run_server(const ServerOptions& options, std::shared_ptr<const Prelude> prelude, std::string& error);
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "snapshot.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace std::string_literals;
+
+static size_t _pad4(size_t size) {
+    return (size + 3) & ~(size_t)3;
+}
+
+uint32_t SnapshotWriter::_string(Symbol sym) {
+    if (sym >= _string_of.size()) _string_of.resize(sym + 1, SNAPSHOT_NONE);
+    if (_string_of[sym] == SNAPSHOT_NONE) {
+        _string_of[sym] = (uint32_t)_strings.size();
+        _strings.push_back(sym);
+    }
+    return _string_of[sym];
+}
+
+//post-order over the term graph, so every child is numbered before its parent
+uint32_t SnapshotWriter::add_term(const Term* term) {
+    std::vector<std::pair<const Term*, bool>> pending; //node, children numbered
+    pending.push_back({ term, false });
+    while (!pending.empty()) {
+        auto [t, ready] = pending.back();
+        pending.pop_back();
+        if (_node_of.count(t)) continue;
+
+        if (!ready && (t->type == TermType::Lam || t->type == TermType::App)) {
+            pending.push_back({ t, true });
+            if (t->type == TermType::Lam) {
+                pending.push_back({ t->lam.body, false });
+            } else {
+                pending.push_back({ t->app.rhs, false });
+                pending.push_back({ t->app.lhs, false });
+            }
+            continue;
+        }
+
+        SnapshotNode node = {};
+        switch (t->type) {
+            case TermType::Var:
+                node.type = SnapshotNodeType::Var;
+                node.a = t->index;
+                break;
+            case TermType::Lam:
+                node.type = SnapshotNodeType::Lam;
+                node.a = _string(t->lam.hint);
+                node.b = _node_of[t->lam.body];
+                break;
+            case TermType::App:
+                node.type = SnapshotNodeType::App;
+                node.a = _node_of[t->app.lhs];
+                node.b = _node_of[t->app.rhs];
+                break;
+            case TermType::Global:
+                node.type = SnapshotNodeType::Global;
+                node.a = _string(t->global.id);
+                break;
+        }
+        _node_of[t] = (uint32_t)_nodes.size();
+        _nodes.push_back(node);
+    }
+    return _node_of[term];
+}
+
+void SnapshotWriter::add_definition(Symbol name, uint32_t term, uint32_t normal, uint32_t flags) {
+    _defs.push_back({ _string(name), term, normal, flags });
+}
+
+std::string SnapshotWriter::bytes() const {
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.string_count = (uint32_t)_strings.size();
+    header.node_count = (uint32_t)_nodes.size();
+    header.def_count = (uint32_t)_defs.size();
+
+    std::vector<uint32_t> offsets;
+    offsets.reserve(_strings.size() + 1);
+    size_t string_bytes = 0;
+    for (Symbol sym : _strings) {
+        offsets.push_back((uint32_t)string_bytes);
+        string_bytes += symbol_name(sym).size();
+    }
+    offsets.push_back((uint32_t)string_bytes);
+    header.string_bytes = (uint32_t)string_bytes;
+
+    std::string out;
+    out.reserve(sizeof(header) + offsets.size() * sizeof(uint32_t) + _pad4(string_bytes)
+        + _nodes.size() * sizeof(SnapshotNode) + _defs.size() * sizeof(SnapshotDef));
+    out.append((const char*)&header, sizeof(header));
+    out.append((const char*)offsets.data(), offsets.size() * sizeof(uint32_t));
+    for (Symbol sym : _strings) out += symbol_name(sym);
+    out.resize(out.size() + _pad4(string_bytes) - string_bytes, '\0');
+    out.append((const char*)_nodes.data(), _nodes.size() * sizeof(SnapshotNode));
+    out.append((const char*)_defs.data(), _defs.size() * sizeof(SnapshotDef));
+    return out;
+}
+
+bool SnapshotWriter::write(const char* path, std::string& error) const {
+    std::string data = bytes();
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        error = "cannot write "s + path + ": " + strerror(errno);
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) error = "cannot write "s + path + ": " + strerror(errno);
+    return ok;
+}
+
+Snapshot::~Snapshot() {
+    if (!_data) return;
+    if (_mapped) {
+        munmap((void*)_data, _size);
+    } else {
+        free((void*)_data);
+    }
+}
+
+std::unique_ptr<Snapshot> Snapshot::open(const char* path, std::string& error) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        error = "cannot read "s + path + ": " + strerror(errno);
+        return nullptr;
+    }
+
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            snapshot->_data = (const char*)mapped;
+            snapshot->_size = (size_t)st.st_size;
+            snapshot->_mapped = true;
+        }
+    }
+
+    //not mappable (a pipe, say): read it all into one buffer instead
+    if (!snapshot->_mapped) {
+        size_t capacity = 64 * 1024;
+        char* buffer = (char*)malloc(capacity);
+        size_t size = 0;
+        while (true) {
+            if (size == capacity) {
+                capacity *= 2;
+                char* grown = (char*)realloc(buffer, capacity);
+                if (!grown) free(buffer);
+                buffer = grown;
+            }
+            if (!buffer) {
+                error = "cannot read "s + path + ": out of memory";
+                close(fd);
+                return nullptr;
+            }
+            ssize_t n = read(fd, buffer + size, capacity - size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                error = "cannot read "s + path + ": " + strerror(errno);
+                free(buffer);
+                close(fd);
+                return nullptr;
+            }
+            if (n == 0) break;
+            size += (size_t)n;
+        }
+        snapshot->_data = buffer;
+        snapshot->_size = size;
+    }
+    close(fd);
+
+    if (!snapshot->_check(error)) {
+        error = path + ": "s + error;
+        return nullptr;
+    }
+    return snapshot;
+}
+
+//validates every record once, so nothing that reads the snapshot afterwards
+//has to check indices
+bool Snapshot::_check(std::string& error) {
+    if (_size < sizeof(SnapshotHeader) || memcmp(_data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        error = "not a snapshot";
+        return false;
+    }
+    _header = (const SnapshotHeader*)_data;
+    if (_header->byte_order != SNAPSHOT_BYTE_ORDER) {
+        error = "snapshot was written on a machine of another byte order";
+        return false;
+    }
+    if (_header->version != SNAPSHOT_VERSION) {
+        error = "snapshot version " + std::to_string(_header->version) + " is not supported, expected "
+            + std::to_string(SNAPSHOT_VERSION);
+        return false;
+    }
+
+    uint64_t offsets_at = sizeof(SnapshotHeader);
+    uint64_t strings_at = offsets_at + ((uint64_t)_header->string_count + 1) * sizeof(uint32_t);
+    uint64_t nodes_at = strings_at + _pad4(_header->string_bytes);
+    uint64_t defs_at = nodes_at + (uint64_t)_header->node_count * sizeof(SnapshotNode);
+    uint64_t end = defs_at + (uint64_t)_header->def_count * sizeof(SnapshotDef);
+    if (end != _size) {
+        error = "snapshot is truncated or has trailing data";
+        return false;
+    }
+    _offsets = (const uint32_t*)(_data + offsets_at);
+    _strings = _data + strings_at;
+    _nodes = (const SnapshotNode*)(_data + nodes_at);
+    _defs = (const SnapshotDef*)(_data + defs_at);
+
+    uint32_t string_count = _header->string_count;
+    if (_offsets[0] != 0 || _offsets[string_count] != _header->string_bytes) {
+        error = "corrupted string table";
+        return false;
+    }
+    for (uint32_t i = 0; i < string_count; i++) {
+        if (_offsets[i] > _offsets[i + 1]) {
+            error = "corrupted string table";
+            return false;
+        }
+    }
+
+    //per node, how many binders must enclose it for its indices to be bound
+    std::vector<uint32_t> open(_header->node_count);
+    for (uint32_t i = 0; i < _header->node_count; i++) {
+        const SnapshotNode& node = _nodes[i];
+        bool ok = true;
+        switch ((uint32_t)node.type) {
+            case (uint32_t)SnapshotNodeType::Var:
+                ok = node.a < UINT32_MAX;
+                open[i] = node.a + 1;
+                break;
+            case (uint32_t)SnapshotNodeType::Lam:
+                ok = node.a < string_count && node.b < i;
+                open[i] = ok && open[node.b] > 0 ? open[node.b] - 1 : 0;
+                break;
+            case (uint32_t)SnapshotNodeType::App:
+                ok = node.a < i && node.b < i;
+                open[i] = ok ? std::max(open[node.a], open[node.b]) : 0;
+                break;
+            case (uint32_t)SnapshotNodeType::Global:
+                ok = node.a < string_count;
+                open[i] = 0;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok) {
+            error = "corrupted node " + std::to_string(i);
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < _header->def_count; i++) {
+        const SnapshotDef& def = _defs[i];
+        bool ok = def.name < string_count && def.term < _header->node_count && open[def.term] == 0;
+        if (def.normal != SNAPSHOT_NONE) ok = ok && def.normal < _header->node_count && open[def.normal] == 0;
+        if (!ok) {
+            error = "corrupted definition " + std::to_string(i);
+            return false;
+        }
+    }
+
+    _symbols.resize(string_count);
+    for (uint32_t i = 0; i < string_count; i++) _symbols[i] = intern(string(i));
+    return true;
+}
+
+std::string_view Snapshot::string(uint32_t index) const {
+    return std::string_view(_strings + _offsets[index], _offsets[index + 1] - _offsets[index]);
+}
+
+//children come first, so one forward pass finds every child already built
+void Snapshot::build_terms(std::vector<TermPtr>& out) const {
+    out.clear();
+    out.resize(_header->node_count);
+    for (uint32_t i = 0; i < _header->node_count; i++) {
+        const SnapshotNode& node = _nodes[i];
+        Term* term = nullptr;
+        switch (node.type) {
+            case SnapshotNodeType::Var:
+                term = term_var(node.a);
+                break;
+            case SnapshotNodeType::Lam:
+                term = term_lam(_symbols[node.a], term_retain(out[node.b].get()));
+                break;
+            case SnapshotNodeType::App:
+                term = term_app(term_retain(out[node.a].get()), term_retain(out[node.b].get()));
+                break;
+            case SnapshotNodeType::Global:
+                term = term_global(_symbols[node.a]);
+                break;
+        }
+        out[i].reset(term);
+    }
+}
\ No newline at end of file
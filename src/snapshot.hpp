@@ -0,0 +1,120 @@
+#pragma once
+
+#include "symbol.hpp"
+#include "term.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Binary snapshot of terms and named definitions. A file is one block of
+// fixed-size records that refer to each other by index, never by address, so
+// it can be mapped and read in place:
+//
+//   SnapshotHeader
+//   uint32_t string_offsets[string_count + 1]  //into the string bytes
+//   char strings[string_bytes]                 //padded to 4 bytes
+//   SnapshotNode nodes[node_count]
+//   SnapshotDef definitions[def_count]
+//
+// Nodes are terms in the reducer's form: de Bruijn indices for bound variables
+// and names for globals and binder hints. A node's children always come before
+// it and identical subterms are written once, so a file is as large as the
+// shared term graph and loads in a single forward pass.
+constexpr char SNAPSHOT_MAGIC[8] = { 'L', 'A', 'M', 'B', 'S', 'N', 'A', 'P' };
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304; //reads back swapped on a machine of the other order
+constexpr uint32_t SNAPSHOT_NONE = UINT32_MAX;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t string_count;
+    uint32_t string_bytes;
+    uint32_t node_count;
+    uint32_t def_count;
+};
+
+enum class SnapshotNodeType : uint32_t {
+    Var,    //a: de Bruijn index
+    Lam,    //a: hint string, b: body node
+    App,    //a: lhs node, b: rhs node
+    Global  //a: name string
+};
+
+struct SnapshotNode {
+    SnapshotNodeType type;
+    uint32_t a;
+    uint32_t b;
+};
+
+constexpr uint32_t SNAPSHOT_NO_NORMAL = 1; //normalizing the definition failed, see Session
+
+struct SnapshotDef {
+    uint32_t name;   //string
+    uint32_t term;   //node, the definition as written
+    uint32_t normal; //node of its normal form, SNAPSHOT_NONE if not computed
+    uint32_t flags;
+};
+
+// Collects terms and definitions and writes them out as a snapshot.
+struct SnapshotWriter {
+    // Returns the node of `term`, adding it and whatever under it is new.
+    uint32_t add_term(const Term* term);
+    void add_definition(Symbol name, uint32_t term, uint32_t normal = SNAPSHOT_NONE, uint32_t flags = 0);
+
+    size_t definition_count() const { return _defs.size(); }
+    std::string bytes() const;
+    bool write(const char* path, std::string& error) const;
+
+private:
+    uint32_t _string(Symbol sym);
+
+    std::vector<uint32_t> _string_of; //per symbol, SNAPSHOT_NONE if not written yet
+    std::vector<Symbol> _strings;
+    std::vector<SnapshotNode> _nodes;
+    std::unordered_map<const Term*, uint32_t> _node_of;
+    std::vector<SnapshotDef> _defs;
+};
+
+// A snapshot file, mapped into memory or, where it cannot be, read with one
+// bulk copy. Opening checks the whole file, so a snapshot that opened never
+// yields a malformed term.
+struct Snapshot {
+    ~Snapshot();
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // nullptr with `error` set if the file cannot be read or is not a valid
+    // snapshot of this version.
+    static std::unique_ptr<Snapshot> open(const char* path, std::string& error);
+
+    const SnapshotHeader& header() const { return *_header; }
+    const SnapshotNode* nodes() const { return _nodes; }
+    const SnapshotDef* definitions() const { return _defs; }
+    std::string_view string(uint32_t index) const;
+    Symbol symbol(uint32_t index) const { return _symbols[index]; }
+
+    // Builds every node in the current factory; out[i] holds a reference to
+    // the term of node i.
+    void build_terms(std::vector<TermPtr>& out) const;
+
+private:
+    Snapshot() {}
+    bool _check(std::string& error);
+
+    const char* _data = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+    const SnapshotHeader* _header = nullptr;
+    const uint32_t* _offsets = nullptr;
+    const char* _strings = nullptr;
+    const SnapshotNode* _nodes = nullptr;
+    const SnapshotDef* _defs = nullptr;
+    std::vector<Symbol> _symbols; //per string
+};
\ No newline at end of file
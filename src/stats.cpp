@@ -0,0 +1,166 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+#if LAMBDA_STATS
+
+constinit thread_local _StatsLocal stats_local = {};
+constinit thread_local Symbol stats_centre = NO_SYMBOL;
+std::atomic<bool> stats_profiling = false;
+
+//per thread: profile entries by centre, NO_SYMBOL in slot 0 and symbol s in
+//slot s + 1, and the slots touched since the last flush
+struct _ProfileLocal {
+    std::vector<ProfileEntry> entries;
+    std::vector<uint32_t> touched;
+};
+
+static thread_local _ProfileLocal _profile_local;
+
+static std::mutex _lock;
+static ReductionStats _totals = {};
+static ReductionStats _last_query = {};
+static std::vector<ProfileEntry> _profile; //same slots as _ProfileLocal
+
+void stats_charge(Symbol centre, uint64_t steps, uint64_t entries) {
+    uint32_t slot = centre == NO_SYMBOL ? 0 : centre + 1;
+    std::vector<ProfileEntry>& local = _profile_local.entries;
+    if (slot >= local.size()) local.resize(std::max<size_t>(slot + 1, local.size() * 2), { NO_SYMBOL, 0, 0 });
+    ProfileEntry& entry = local[slot];
+    if (entry.steps == 0 && entry.entries == 0) _profile_local.touched.push_back(slot);
+    entry.steps += steps;
+    entry.entries += entries;
+}
+
+static void _add(ReductionStats& to, const ReductionStats& from) {
+    to.queries += from.queries;
+    to.steps += from.steps;
+    to.lookups += from.lookups;
+    to.index_probes += from.index_probes;
+    to.normalizations += from.normalizations;
+    to.thunks_forced += from.thunks_forced;
+    to.deltas += from.deltas;
+    to.peak_depth = std::max(to.peak_depth, from.peak_depth);
+    to.tokens += from.tokens;
+    to.exprs += from.exprs;
+    to.expr_copies += from.expr_copies;
+    to.parse_ns += from.parse_ns;
+    to.compile_ns += from.compile_ns;
+    to.eval_ns += from.eval_ns;
+    to.read_back_ns += from.read_back_ns;
+}
+
+//counts only ever grow, so the difference of two totals is what ran between them
+static ReductionStats _since(const ReductionStats& now, const ReductionStats& start) {
+    ReductionStats d;
+    d.queries = now.queries - start.queries;
+    d.steps = now.steps - start.steps;
+    d.lookups = now.lookups - start.lookups;
+    d.index_probes = now.index_probes - start.index_probes;
+    d.normalizations = now.normalizations - start.normalizations;
+    d.thunks_forced = now.thunks_forced - start.thunks_forced;
+    d.deltas = now.deltas - start.deltas;
+    d.peak_depth = 0;
+    d.tokens = now.tokens - start.tokens;
+    d.exprs = now.exprs - start.exprs;
+    d.expr_copies = now.expr_copies - start.expr_copies;
+    d.parse_ns = now.parse_ns - start.parse_ns;
+    d.compile_ns = now.compile_ns - start.compile_ns;
+    d.eval_ns = now.eval_ns - start.eval_ns;
+    d.read_back_ns = now.read_back_ns - start.read_back_ns;
+    return d;
+}
+
+void stats_flush() {
+    std::lock_guard<std::mutex> guard(_lock);
+    _add(_totals, stats_local.counts);
+    stats_local.counts = {};
+
+    std::vector<ProfileEntry>& local = _profile_local.entries;
+    for (uint32_t slot : _profile_local.touched) {
+        if (slot >= _profile.size()) _profile.resize(local.size(), { NO_SYMBOL, 0, 0 });
+        _profile[slot].steps += local[slot].steps;
+        _profile[slot].entries += local[slot].entries;
+        local[slot].steps = 0;
+        local[slot].entries = 0;
+    }
+    _profile_local.touched.clear();
+}
+
+ReductionStats get_stats() {
+    stats_flush();
+    std::lock_guard<std::mutex> guard(_lock);
+    return _totals;
+}
+
+void reset_stats() {
+    stats_flush();
+    std::lock_guard<std::mutex> guard(_lock);
+    _totals = {};
+    _last_query = {};
+}
+
+QueryStats::QueryStats() {
+    _start = get_stats();
+    stats_local.query_peak = 0;
+}
+
+QueryStats::~QueryStats() {
+    uint64_t peak = stats_local.query_peak;
+    ReductionStats now = get_stats();
+    std::lock_guard<std::mutex> guard(_lock);
+    _last_query = _since(now, _start);
+    _last_query.peak_depth = peak;
+}
+
+ReductionStats last_query_stats() {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _last_query;
+}
+
+void set_profiling(bool on) {
+    stats_profiling.store(on, std::memory_order_relaxed);
+}
+
+bool profiling() {
+    return stats_profiling.load(std::memory_order_relaxed);
+}
+
+std::vector<ProfileEntry> get_profile() {
+    stats_flush();
+    std::vector<ProfileEntry> out;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        for (size_t slot = 0; slot < _profile.size(); slot++) {
+            const ProfileEntry& entry = _profile[slot];
+            if (entry.steps == 0 && entry.entries == 0) continue;
+            out.push_back({ slot == 0 ? NO_SYMBOL : (Symbol)(slot - 1), entry.steps, entry.entries });
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const ProfileEntry& a, const ProfileEntry& b) {
+        return a.steps != b.steps ? a.steps > b.steps : a.entries > b.entries;
+    });
+    return out;
+}
+
+void reset_profile() {
+    stats_flush();
+    std::lock_guard<std::mutex> guard(_lock);
+    _profile.clear();
+}
+
+#else
+
+ReductionStats get_stats() { return {}; }
+void reset_stats() {}
+QueryStats::QueryStats() : _start() {}
+QueryStats::~QueryStats() {}
+ReductionStats last_query_stats() { return {}; }
+void set_profiling(bool) {}
+bool profiling() { return false; }
+std::vector<ProfileEntry> get_profile() { return {}; }
+void reset_profile() {}
+void stats_flush() {}
+
+#endif
\ No newline at end of file
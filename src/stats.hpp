@@ -0,0 +1,143 @@
+#pragma once
+
+#include "symbol.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Counters and timers for the hot paths of parsing, building expressions and
+// reducing. Each thread counts into plain thread-local fields, which are
+// merged into the process totals when a reduction or a parallel task ends and
+// whenever the totals are read. Building with LAMBDA_STATS=0 compiles every
+// counter out; the getters then return zeros.
+#ifndef LAMBDA_STATS
+#define LAMBDA_STATS 1
+#endif
+
+struct ReductionStats {
+    uint64_t queries;           //reductions started
+    uint64_t steps;             //closures entered: beta reductions and read-back under binders
+    uint64_t lookups;           //globals resolved through an environment
+    uint64_t index_probes;      //names hashed into an environment's index
+    uint64_t normalizations;    //normal forms of definitions computed
+    uint64_t thunks_forced;
+    uint64_t deltas;            //native mode: arithmetic computed directly on literals
+    uint64_t peak_depth;        //most closure bodies entered at once on the C++ stack, or deepest machine stack
+    uint64_t tokens;            //tokens lexed
+    uint64_t exprs;             //Expr nodes allocated
+    uint64_t expr_copies;       //Expr nodes copied from another one
+    uint64_t parse_ns;
+    uint64_t compile_ns;        //named expressions to terms
+    uint64_t eval_ns;           //normalizing, read-back to terms included
+    uint64_t read_back_ns;      //normal forms to named expressions
+};
+
+// Reduction steps charged to the global whose code took them. A value is
+// tagged with the global being evaluated when it was created, and entering a
+// closure charges the step to the closure's global, so a combinator is billed
+// for its own body wherever it runs.
+struct ProfileEntry {
+    Symbol global;      //NO_SYMBOL: code written in the query itself
+    uint64_t steps;
+    uint64_t entries;   //times a reference to the global was evaluated
+};
+
+constexpr bool stats_enabled() { return LAMBDA_STATS != 0; }
+
+ReductionStats get_stats();
+void reset_stats();
+
+// Statistics of everything this thread ran while it lived, kept as the last
+// query's once it ends.
+struct QueryStats {
+    QueryStats();
+    ~QueryStats();
+    QueryStats(const QueryStats&) = delete;
+    QueryStats& operator=(const QueryStats&) = delete;
+
+private:
+    ReductionStats _start;
+};
+
+ReductionStats last_query_stats();
+
+// Profiling costs a little per step, so it only runs once switched on.
+void set_profiling(bool on);
+bool profiling();
+std::vector<ProfileEntry> get_profile(); //most steps first
+void reset_profile();
+
+// Merges this thread's counts into the totals.
+void stats_flush();
+
+#if LAMBDA_STATS
+
+struct _StatsLocal {
+    ReductionStats counts;
+    uint64_t depth;
+    uint64_t query_peak; //peak depth since the current QueryStats began, flushing keeps it
+};
+
+extern constinit thread_local _StatsLocal stats_local;
+extern constinit thread_local Symbol stats_centre;
+extern std::atomic<bool> stats_profiling;
+
+void stats_charge(Symbol centre, uint64_t steps, uint64_t entries);
+
+#define STAT_ADD(counter, n) (stats_local.counts.counter += (n))
+#define STAT_INC(counter) STAT_ADD(counter, 1)
+#define STAT_CONCAT2(a, b) a##b
+#define STAT_CONCAT(a, b) STAT_CONCAT2(a, b)
+#define STAT_TIME(counter) StatTimer STAT_CONCAT(_stat_timer_, __LINE__)(stats_local.counts.counter)
+#define STAT_DEPTH() StatDepth STAT_CONCAT(_stat_depth_, __LINE__)
+
+struct StatTimer {
+    explicit StatTimer(uint64_t& counter) : _counter(counter), _start(std::chrono::steady_clock::now()) {}
+    ~StatTimer() {
+        _counter += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _start).count();
+    }
+
+private:
+    uint64_t& _counter;
+    std::chrono::steady_clock::time_point _start;
+};
+
+inline void stat_depth(uint64_t depth) {
+    if (depth > stats_local.counts.peak_depth) stats_local.counts.peak_depth = depth;
+    if (depth > stats_local.query_peak) stats_local.query_peak = depth;
+}
+
+struct StatDepth {
+    StatDepth() { stat_depth(++stats_local.depth); }
+    ~StatDepth() { stats_local.depth--; }
+};
+
+inline Symbol stat_centre() { return stats_centre; }
+inline void stat_set_centre(Symbol centre) { stats_centre = centre; }
+
+inline void stat_step(Symbol centre) {
+    stats_local.counts.steps++;
+    if (stats_profiling.load(std::memory_order_relaxed)) stats_charge(centre, 1, 0);
+}
+
+inline void stat_enter_global(Symbol global) {
+    if (stats_profiling.load(std::memory_order_relaxed)) stats_charge(global, 0, 1);
+}
+
+#else
+
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_INC(counter) ((void)0)
+#define STAT_TIME(counter) ((void)0)
+#define STAT_DEPTH() ((void)0)
+
+inline void stat_depth(uint64_t) {}
+inline Symbol stat_centre() { return NO_SYMBOL; }
+inline void stat_set_centre(Symbol) {}
+inline void stat_step(Symbol) {}
+inline void stat_enter_global(Symbol) {}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "symbol.hpp"
+#include "hashmap.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+
+// Names live in fixed-size chunks that never move, so symbol_name needs no
+// lock: a symbol id is only ever seen after the intern call that published it.
+// The index is guarded by a reader-writer lock since several threads intern.
+static constexpr size_t _CHUNK_BITS = 12;
+static constexpr size_t _CHUNK_SIZE = 1 << _CHUNK_BITS;
+static constexpr size_t _MAX_CHUNKS = 1 << 20;
+
+static std::string* _chunks[_MAX_CHUNKS];
+static std::atomic<size_t> _count = 0;
+static StringMap<Symbol> _index;
+static std::shared_mutex _lock;
+
+static std::string& _name(Symbol sym) {
+    return _chunks[sym >> _CHUNK_BITS][sym & (_CHUNK_SIZE - 1)];
+}
+
+Symbol intern(std::string_view name) {
+    {
+        std::shared_lock read(_lock);
+        Symbol* found = _index.find(name);
+        if (found) return *found;
+    }
+
+    std::unique_lock write(_lock);
+    Symbol* found = _index.find(name);
+    if (found) return *found;
+
+    Symbol sym = (Symbol)_count.load(std::memory_order_relaxed);
+    if ((sym & (_CHUNK_SIZE - 1)) == 0) _chunks[sym >> _CHUNK_BITS] = new std::string[_CHUNK_SIZE];
+    std::string& stored = _name(sym);
+    stored.assign(name);
+    _index.insert(stored, sym);
+    _count.store(sym + 1, std::memory_order_release);
+    return sym;
+}
+
+Symbol find_symbol(std::string_view name) {
+    std::shared_lock read(_lock);
+    Symbol* found = _index.find(name);
+    if (!found) return NO_SYMBOL;
+    return *found;
+}
+
+std::string_view symbol_name(Symbol sym) {
+    return _name(sym);
+}
+
+const char* symbol_cstr(Symbol sym) {
+    return _name(sym).c_str();
+}
+
+size_t symbol_count() {
+    return _count.load(std::memory_order_acquire);
+}
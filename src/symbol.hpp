@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Identifiers are interned once and referred to by a dense 32-bit id, so
+// comparing two identifiers is an integer compare.
+using Symbol = uint32_t;
+
+constexpr Symbol NO_SYMBOL = UINT32_MAX;
+
+Symbol intern(std::string_view name);
+Symbol find_symbol(std::string_view name); //NO_SYMBOL if never interned
+std::string_view symbol_name(Symbol sym);
+const char* symbol_cstr(Symbol sym);
+size_t symbol_count();
@@ -0,0 +1,474 @@
+#include "term.hpp"
+#include "arena.hpp"
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//never destroyed, definitions may still release terms during static teardown
+static TermFactory& _global = *new TermFactory;
+static thread_local TermFactory* _current = nullptr;
+
+#if LAMBDA_ATOMIC_REFS
+
+//a node whose count drops to zero is dead: releases do not take the lock, so
+//the table revives nothing and only counts up from a count it saw non-zero
+static bool _try_retain(Term* t) {
+    std::atomic_ref<uint32_t> refs(t->refs);
+    uint32_t n = refs.load(std::memory_order_relaxed);
+    while (n != 0) {
+        if (refs.compare_exchange_weak(n, n + 1, std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+static void _retain(Term* t) {
+    std::atomic_ref<uint32_t>(t->refs).fetch_add(1, std::memory_order_relaxed);
+}
+
+static bool _drop(Term* t) {
+    return std::atomic_ref<uint32_t>(t->refs).fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+#define FACTORY_LOCK() std::lock_guard<std::mutex> _factory_guard(_lock)
+
+#else
+
+static bool _try_retain(Term* t) {
+    if (t->refs == 0) return false;
+    t->refs++;
+    return true;
+}
+static void _retain(Term* t) { t->refs++; }
+static bool _drop(Term* t) { return --t->refs == 0; }
+
+#define FACTORY_LOCK() ((void)0)
+
+#endif
+
+//64-bit so that hashing long chains like f (f (f ...)) cannot fall into a
+//short cycle of repeating values
+static uint64_t _mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t _hash(const Term& t) {
+    uint64_t h = (uint64_t)t.type + 1;
+    switch (t.type) {
+        case TermType::Var: return _mix(h, t.index);
+        case TermType::Global: return _mix(h, t.global.id);
+        case TermType::Lam: return _mix(_mix(h, t.lam.hint), t.lam.body->hash);
+        case TermType::App: return _mix(_mix(h, t.app.lhs->hash), t.app.rhs->hash);
+    }
+    return h;
+}
+
+//children are already interned, so comparing their pointers is enough
+static bool _same(const Term& a, const Term& b) {
+    if (a.type != b.type || a.hash != b.hash) return false;
+    switch (a.type) {
+        case TermType::Var: return a.index == b.index;
+        case TermType::Global: return a.global.id == b.global.id;
+        case TermType::Lam: return a.lam.hint == b.lam.hint && a.lam.body == b.lam.body;
+        case TermType::App: return a.app.lhs == b.app.lhs && a.app.rhs == b.app.rhs;
+    }
+    return false;
+}
+
+TermFactory::TermFactory() {}
+
+TermFactory::~TermFactory() {
+    free(_slots);
+}
+
+TermFactory* TermFactory::current() {
+    return _current ? _current : &_global;
+}
+
+TermScope::TermScope(TermFactory* factory) {
+    _prev = _current;
+    _current = factory;
+}
+
+TermScope::~TermScope() {
+    _current = _prev;
+}
+
+void TermFactory::_grow() {
+    size_t old_capacity = _capacity;
+    Term** old_slots = _slots;
+    size_t capacity = _capacity ? _capacity * 2 : 1024;
+    Term** slots = (Term**)calloc(capacity, sizeof(Term*));
+    if (!slots) throw std::bad_alloc();
+    _capacity = capacity;
+    _slots = slots;
+    for (size_t i = 0; i < old_capacity; i++) {
+        Term* t = old_slots[i];
+        if (!t) continue;
+        size_t j = t->hash & (_capacity - 1);
+        while (_slots[j]) j = (j + 1) & (_capacity - 1);
+        _slots[j] = t;
+    }
+    free(old_slots);
+}
+
+//the table holds no references: a node leaves it when its last reference is
+//released, so it never keeps garbage alive
+Term* TermFactory::intern(const Term& key, bool& created) {
+    FACTORY_LOCK();
+    if ((_count + 1) * 2 > _capacity) _grow();
+    size_t mask = _capacity - 1;
+    size_t i = key.hash & mask;
+    while (_slots[i]) {
+        if (_same(*_slots[i], key) && _try_retain(_slots[i])) {
+            _hits++;
+            created = false;
+            return _slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    _misses++;
+    created = true;
+    Term* term = (Term*)_pool.alloc_node(sizeof(Term));
+    *term = key;
+    term->refs = 1;
+    _slots[i] = term;
+    _count++;
+    return term;
+}
+
+//backward-shift deletion keeps probe sequences intact without tombstones
+void TermFactory::remove(Term* term) {
+    FACTORY_LOCK();
+    size_t mask = _capacity - 1;
+    size_t i = term->hash & mask;
+    while (_slots[i] != term) i = (i + 1) & mask;
+
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (!_slots[j]) break;
+        size_t home = _slots[j]->hash & mask;
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) continue;
+        _slots[i] = _slots[j];
+        i = j;
+    }
+    _slots[i] = nullptr;
+    _count--;
+    _pool.free_node(term, sizeof(Term));
+}
+
+void TermFactory::freeze() {
+    FACTORY_LOCK();
+    for (size_t i = 0; i < _capacity; i++) {
+        if (!_slots[i]) continue;
+        _slots[i]->refs = TERM_IMMORTAL;
+        _slots[i] = nullptr;
+    }
+    _count = 0;
+}
+
+TermStats TermFactory::stats() const {
+    TermStats stats;
+    stats.live_nodes = _count;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    return stats;
+}
+
+static Term* _intern(Term& key, bool& created) {
+    key.hash = _hash(key);
+    return TermFactory::current()->intern(key, created);
+}
+
+Term* term_var(uint32_t index) {
+    Term key;
+    key.type = TermType::Var;
+    key.index = index;
+    bool created;
+    return _intern(key, created);
+}
+
+Term* term_lam(Symbol hint, Term* body) {
+    Term key;
+    key.type = TermType::Lam;
+    key.lam.hint = hint;
+    key.lam.body = body;
+    bool created;
+    Term* term = _intern(key, created);
+    if (!created) term_release(body); //existing node already owns one
+    return term;
+}
+
+Term* term_app(Term* lhs, Term* rhs) {
+    Term key;
+    key.type = TermType::App;
+    key.app.lhs = lhs;
+    key.app.rhs = rhs;
+    bool created;
+    Term* term = _intern(key, created);
+    if (!created) {
+        term_release(lhs);
+        term_release(rhs);
+    }
+    return term;
+}
+
+Term* term_global(Symbol id) {
+    Term key;
+    key.type = TermType::Global;
+    key.global.id = id;
+    key.global.handle = UINT32_MAX;
+    bool created;
+    return _intern(key, created);
+}
+
+Term* term_retain(Term* term) {
+    if (!term_immortal(term)) _retain(term);
+    return term;
+}
+
+void term_release(Term* term) {
+    //most releases leave the node alive, and those need no work list
+    if (!term || term_immortal(term) || !_drop(term)) return;
+
+    //explicit stack, releasing a long spine must not recurse
+    TermFactory* factory = TermFactory::current();
+    std::vector<Term*> pending;
+    pending.push_back(term);
+    while (!pending.empty()) {
+        Term* t = pending.back();
+        pending.pop_back();
+        if (t != term && (term_immortal(t) || !_drop(t))) continue;
+        if (t->type == TermType::Lam) {
+            pending.push_back(t->lam.body);
+        } else if (t->type == TermType::App) {
+            pending.push_back(t->app.lhs);
+            pending.push_back(t->app.rhs);
+        }
+        factory->remove(t);
+    }
+}
+
+TermStats get_term_stats() {
+    return TermFactory::current()->stats();
+}
+
+void term_globals(const Term* term, std::vector<Symbol>& out) {
+    std::unordered_set<const Term*> seen;
+    std::vector<const Term*> pending;
+    pending.push_back(term);
+    while (!pending.empty()) {
+        const Term* t = pending.back();
+        pending.pop_back();
+        if (!seen.insert(t).second) continue;
+        switch (t->type) {
+            case TermType::Var:
+                break;
+            case TermType::Global:
+                //there is one Global node per symbol, so this never repeats
+                out.push_back(t->global.id);
+                break;
+            case TermType::Lam:
+                pending.push_back(t->lam.body);
+                break;
+            case TermType::App:
+                pending.push_back(t->app.rhs);
+                pending.push_back(t->app.lhs);
+                break;
+        }
+    }
+}
+
+//terms are built children first, so compiling runs off an explicit work list
+//too: a node is visited on the way down and again, `built`, once the terms of
+//its children are on top of the result stack
+struct _CompileWork {
+    const Expr* expr;
+    bool built;
+};
+
+Term* compile_expr(const Expr& expr) {
+    std::vector<Symbol> scope;
+    std::vector<_CompileWork> pending;
+    std::vector<Term*> results;
+    pending.push_back({ &expr, false });
+    while (!pending.empty()) {
+        _CompileWork work = pending.back();
+        pending.pop_back();
+        const Expr& e = *work.expr;
+
+        if (work.built) {
+            Term* last = results.back();
+            results.pop_back();
+            if (e._type == ExprType::Fn) {
+                scope.pop_back();
+                results.push_back(term_lam(e._fn.id, last));
+            } else {
+                results.back() = term_app(results.back(), last);
+            }
+            continue;
+        }
+
+        switch (e._type) {
+        default:
+        case ExprType::Empty:
+            for (Term* t : results) term_release(t);
+            return nullptr;
+        case ExprType::Var: {
+            Term* t = nullptr;
+            for (size_t i = scope.size(); i > 0 && !t; i--) {
+                if (scope[i - 1] == e._var) t = term_var((uint32_t)(scope.size() - i));
+            }
+            results.push_back(t ? t : term_global(e._var));
+            break;
+        }
+        case ExprType::Fn:
+            scope.push_back(e._fn.id);
+            pending.push_back({ &e, true });
+            pending.push_back({ e._fn.body, false });
+            break;
+        case ExprType::App:
+            pending.push_back({ &e, true });
+            pending.push_back({ e._app.rhs, false });
+            pending.push_back({ e._app.lhs, false });
+            break;
+        }
+    }
+    return results.back();
+}
+
+bool NameScope::is_taken(Symbol sym) const {
+    return sym < taken.size() && taken[sym] != 0;
+}
+
+void NameScope::take(Symbol sym) {
+    if (sym >= taken.size()) taken.resize(sym + 1, 0);
+    taken[sym]++;
+}
+
+Symbol NameScope::fresh(Symbol hint) const {
+    if (!is_taken(hint)) return hint;
+    std::string base(symbol_name(hint));
+    for (uint32_t n = 1;; n++) {
+        Symbol candidate = intern(base + std::to_string(n));
+        if (!is_taken(candidate)) return candidate;
+    }
+}
+
+Symbol NameScope::push(Symbol hint) {
+    Symbol name = fresh(hint);
+    names.push_back(name);
+    take(name);
+    return name;
+}
+
+void NameScope::pop() {
+    taken[names.back()]--;
+    names.pop_back();
+}
+
+static void _collect_globals(const Term* term, NameScope& namer) {
+    std::vector<const Term*> pending;
+    pending.push_back(term);
+    while (!pending.empty()) {
+        const Term* t = pending.back();
+        pending.pop_back();
+        switch (t->type) {
+            case TermType::Var:
+                break;
+            case TermType::Global:
+                if (!namer.is_taken(t->global.id)) namer.take(t->global.id);
+                break;
+            case TermType::Lam:
+                pending.push_back(t->lam.body);
+                break;
+            case TermType::App:
+                pending.push_back(t->app.rhs);
+                pending.push_back(t->app.lhs);
+                break;
+        }
+    }
+}
+
+//nodes are allocated before their children are filled in, so the conversion
+//runs off an explicit work list and deep results do not exhaust the C++ stack
+struct _ToExprWork {
+    const Term* term; //nullptr: leave the scope of the innermost binder
+    Expr* out;
+};
+
+//nodes come from the back of `spare` while it lasts
+static void _to_expr(const Term* term, Expr* root, std::vector<Expr*>& spare) {
+    NameScope namer;
+    _collect_globals(term, namer);
+
+    auto node = [&]() {
+        if (spare.empty()) return new Expr;
+        Expr* e = spare.back();
+        spare.pop_back();
+        return e;
+    };
+
+    std::vector<_ToExprWork> pending;
+    pending.push_back({ term, root });
+    while (!pending.empty()) {
+        _ToExprWork work = pending.back();
+        pending.pop_back();
+
+        if (!work.term) {
+            namer.pop();
+            continue;
+        }
+
+        const Term* t = work.term;
+        Expr* expr = work.out;
+        switch (t->type) {
+            case TermType::Var:
+                expr->_type = ExprType::Var;
+                expr->_var = namer.names[namer.names.size() - 1 - t->index];
+                break;
+            case TermType::Global:
+                expr->_type = ExprType::Var;
+                expr->_var = t->global.id;
+                break;
+            case TermType::Lam: {
+                expr->_fn.id = namer.push(t->lam.hint);
+                expr->_fn.body = node();
+                expr->_type = ExprType::Fn;
+                pending.push_back({ nullptr, nullptr });
+                pending.push_back({ t->lam.body, expr->_fn.body });
+                break;
+            }
+            case TermType::App:
+                expr->_app.lhs = node();
+                expr->_app.rhs = node();
+                expr->_type = ExprType::App;
+                pending.push_back({ t->app.rhs, expr->_app.rhs });
+                pending.push_back({ t->app.lhs, expr->_app.lhs });
+                break;
+        }
+    }
+}
+
+Expr* term_to_expr(const Term* term) {
+    Expr* root = new Expr;
+    std::vector<Expr*> spare;
+    _to_expr(term, root, spare);
+    return root;
+}
+
+void term_to_expr(const Term* term, Expr& out, std::vector<Expr*>& spare) {
+    _to_expr(term, &out, spare);
+    for (Expr* e : spare) delete e;
+    spare.clear();
+}
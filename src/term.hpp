@@ -0,0 +1,162 @@
+#pragma once
+
+#include "arena.hpp"
+#include "expr.hpp"
+#include "symbol.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Core representation the reducer runs on. Bound variables are de Bruijn
+// indices (0 is the innermost enclosing lambda), free variables are globals
+// looked up in the environment. Binder names are kept only as display hints.
+//
+// Terms are hash-consed: structurally identical terms (hints included) are
+// the same node, so equality is a pointer compare and sharing a term is a
+// reference count bump. Nodes are immutable once built.
+//
+// Reference counts are plain integers. Building with LAMBDA_ATOMIC_REFS=1
+// makes them atomic and puts a lock around each factory's table, so any
+// number of threads may have one factory current and share its terms, at the
+// price of an atomic operation per retain and release.
+#ifndef LAMBDA_ATOMIC_REFS
+#define LAMBDA_ATOMIC_REFS 0
+#endif
+
+enum class TermType : uint8_t {
+    Var,
+    Lam,
+    App,
+    Global
+};
+
+struct Term {
+    TermType type;
+    uint32_t refs;
+    uint64_t hash;
+    union {
+        uint32_t index;
+        struct { Symbol hint; Term* body; } lam;
+        struct { Term* lhs; Term* rhs; } app;
+        //the handle caches where the environment keeps this name; it is not
+        //part of the term's identity
+        struct { Symbol id; uint32_t handle; } global;
+    };
+};
+
+constexpr uint32_t TERM_IMMORTAL = UINT32_MAX; //reference count of a frozen node, see TermFactory::freeze
+
+struct TermStats {
+    size_t live_nodes;
+    size_t hits;    //constructor calls answered by an existing node
+    size_t misses;  //constructor calls that created a node
+};
+
+// Intern table that owns term nodes. Constructors build in the factory made
+// current on this thread by a TermScope, or in a process-wide one without it,
+// and a reference must be released while the factory that built it is
+// current. Factories are independent, so threads with factories of their own
+// never share mutable state; sharing one needs LAMBDA_ATOMIC_REFS.
+struct TermFactory {
+    TermFactory();
+    ~TermFactory();
+    TermFactory(const TermFactory&) = delete;
+    TermFactory& operator=(const TermFactory&) = delete;
+
+    // Makes every node built so far immortal and drops it from the table. Such
+    // nodes stay valid for as long as the factory lives, ignore retain and
+    // release, may be read from any thread, and are never handed out again by
+    // the constructors.
+    void freeze();
+    TermStats stats() const;
+
+    //used by the term constructors and term_release. intern hands out a new
+    //reference and sets `created` if the node did not exist yet
+    Term* intern(const Term& key, bool& created);
+    void remove(Term* term);
+
+    static TermFactory* current();
+
+private:
+    void _grow();
+
+    Arena _pool;
+    Term** _slots = nullptr;
+    size_t _capacity = 0;
+    size_t _count = 0;
+    size_t _hits = 0;
+    size_t _misses = 0;
+#if LAMBDA_ATOMIC_REFS
+    std::mutex _lock;
+#endif
+};
+
+// Makes a factory current on this thread until the scope ends; nullptr selects
+// the process-wide one.
+struct TermScope {
+    explicit TermScope(TermFactory* factory);
+    ~TermScope();
+    TermScope(const TermScope&) = delete;
+    TermScope& operator=(const TermScope&) = delete;
+
+private:
+    TermFactory* _prev;
+};
+
+// Constructors return a new reference and take over the references passed in
+// as children, so nested calls build a term without any extra bookkeeping.
+Term* term_var(uint32_t index);
+Term* term_lam(Symbol hint, Term* body);
+Term* term_app(Term* lhs, Term* rhs);
+Term* term_global(Symbol id);
+Term* term_retain(Term* term);
+void term_release(Term* term);
+
+inline bool term_immortal(const Term* term) {
+#if LAMBDA_ATOMIC_REFS
+    uint32_t& refs = const_cast<uint32_t&>(term->refs);
+    return std::atomic_ref<uint32_t>(refs).load(std::memory_order_relaxed) == TERM_IMMORTAL;
+#else
+    return term->refs == TERM_IMMORTAL;
+#endif
+}
+
+// Statistics of the current factory.
+TermStats get_term_stats();
+
+struct TermDeleter {
+    void operator()(Term* term) const { term_release(term); }
+};
+
+using TermPtr = std::unique_ptr<Term, TermDeleter>;
+
+// Appends the distinct globals referenced by `term` to `out`.
+void term_globals(const Term* term, std::vector<Symbol>& out);
+
+// Resolves names to indices; nullptr if the expression is corrupted.
+// Returns a new reference.
+Term* compile_expr(const Expr& expr);
+
+// Picks display names for binders while converting back to named form. A
+// binder keeps its hint unless an enclosing binder or a global in the term
+// already uses that name, in which case a numbered variant is used instead.
+struct NameScope {
+    std::vector<Symbol> names;      //name given to each enclosing binder, outermost first
+    std::vector<uint32_t> taken;    //per symbol: binders in scope using it, or globals in the term
+
+    bool is_taken(Symbol sym) const;
+    void take(Symbol sym);
+    Symbol push(Symbol hint); //enters a binder, returns its name
+    void pop();
+    Symbol fresh(Symbol hint) const;
+};
+
+// Converts back to named form, naming binders through a NameScope.
+Expr* term_to_expr(const Term* term);
+// Same, but converts into `out`, which must be empty, and builds the result
+// from the nodes in `spare` before allocating any. Spare nodes left over are
+// deleted.
+void term_to_expr(const Term* term, Expr& out, std::vector<Expr*>& spare);
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+//index of the calling worker's own queue in its pool, if it is a worker
+static thread_local const ThreadPool* _worker_pool = nullptr;
+static thread_local size_t _worker_index = 0;
+
+ThreadPool::ThreadPool(unsigned workers) {
+    _queue_count = (size_t)workers + 1;
+    _queues.reset(new _Queue[_queue_count]);
+    _threads.reserve(workers);
+    for (unsigned i = 0; i < workers; i++) {
+        _threads.emplace_back([this, i] { _worker(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(_sleep_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& t : _threads) t.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+size_t ThreadPool::_self() const {
+    return _worker_pool == this ? _worker_index : _queue_count - 1;
+}
+
+void ThreadPool::_push(_Task task) {
+    _Queue& queue = _queues[_self()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+    _queued.fetch_add(1, std::memory_order_release);
+    //taking the lock orders this against a worker that is about to sleep
+    { std::lock_guard<std::mutex> guard(_sleep_lock); }
+    _wake.notify_one();
+}
+
+bool ThreadPool::_run_one(size_t self) {
+    _Task task;
+    bool found = false;
+    {
+        _Queue& own = _queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (size_t i = 1; !found && i < _queue_count; i++) {
+        _Queue& victim = _queues[(self + i) % _queue_count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.tasks.empty()) continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        found = true;
+        _steals.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!found) return false;
+
+    _queued.fetch_sub(1, std::memory_order_relaxed);
+    task.fn();
+    task.group->_pending.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+void ThreadPool::_worker(size_t self) {
+    _worker_pool = this;
+    _worker_index = self;
+    while (true) {
+        if (_run_one(self)) continue;
+        std::unique_lock<std::mutex> lock(_sleep_lock);
+        _wake.wait(lock, [this] { return _stop || _queued.load(std::memory_order_acquire) > 0; });
+        if (_stop) return;
+    }
+}
+
+void TaskGroup::spawn(std::function<void()> fn) {
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    _pool._push({ std::move(fn), this });
+}
+
+void TaskGroup::wait() {
+    size_t self = _pool._self();
+    while (_pending.load(std::memory_order_acquire) > 0) {
+        //help out rather than block, the task we wait for may be queued behind others
+        if (!_pool._run_one(self)) std::this_thread::yield();
+    }
+}
\ No newline at end of file
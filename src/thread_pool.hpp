@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TaskGroup;
+
+// Work-stealing pool. Every worker has a deque of its own: it pushes and pops
+// the newest task at the back, and when it runs dry it steals the oldest task
+// at the front of another deque. Old tasks are the big ones in a divide and
+// conquer split, so a steal moves as much work as possible per lock.
+struct ThreadPool {
+    explicit ThreadPool(unsigned workers);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned workers() const { return (unsigned)_threads.size(); }
+    size_t steals() const { return _steals.load(std::memory_order_relaxed); }
+
+    // Pool with one worker per hardware thread besides the caller's, created on
+    // first use.
+    static ThreadPool& shared();
+
+private:
+    struct _Task {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+
+    struct _Queue {
+        std::mutex lock;
+        std::deque<_Task> tasks;
+    };
+
+    void _push(_Task task);
+    bool _run_one(size_t self);
+    void _worker(size_t self);
+    size_t _self() const;
+
+    std::vector<std::thread> _threads;
+    std::unique_ptr<_Queue[]> _queues; //one per worker, the last one is shared by outside threads
+    size_t _queue_count;
+    std::atomic<size_t> _queued = 0;
+    std::atomic<size_t> _steals = 0;
+    std::mutex _sleep_lock;
+    std::condition_variable _wake;
+    bool _stop = false;
+
+    friend struct TaskGroup;
+};
+
+// Set of tasks spawned on a pool that can be waited for together. Waiting
+// runs queued tasks instead of blocking, so tasks may spawn and wait on
+// groups of their own without starving the pool.
+struct TaskGroup {
+    explicit TaskGroup(ThreadPool& pool) : _pool(pool) {}
+    ~TaskGroup() { wait(); }
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void spawn(std::function<void()> fn);
+    void wait();
+
+private:
+    ThreadPool& _pool;
+    std::atomic<size_t> _pending = 0;
+
+    friend struct ThreadPool;
+};
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "arena.hpp"
+#include "eval.hpp"
+#include "stats.hpp"
+#include "symbol.hpp"
+#include "term.hpp"
+
+#include <cstdint>
+
+// Runtime values shared by the evaluators. They are allocated in the arena of
+// the evaluation that creates them and never freed individually.
+enum class ValueType : uint8_t {
+    Closure,
+    NVar,   //a variable bound by a lambda we are reading back under
+    NApp,   //a stuck application whose head is an NVar
+    Thunk,  //an argument not evaluated yet, see thunk_new
+    //literals of native mode, each standing for the lambda in its comment (see native.hpp)
+    Numeral,    //\f.\x.f^n x
+    NumeralFn,  //\x.f^n x with f bound
+    Boolean,    //\a.\b.a when true, \a.\b.b when false
+    BooleanFn,  //\b.a or \b.b with a bound
+    Delta       //a recognized arithmetic operator applied to fewer arguments than it takes
+};
+
+struct Env;
+struct NativeOp;
+
+struct Value {
+    ValueType type;
+    Symbol centre; //global whose code created the value, kept only for the profile (see stats.hpp)
+    union {
+        struct { Symbol hint; const Term* body; const Env* env; } closure;
+        uint32_t level;
+        struct { Value* fn; Value* arg; } napp;
+        struct { const Term* term; const Env* env; Value* result; } thunk;
+        struct { uint64_t n; Symbol f; Symbol x; } numeral;
+        struct { uint64_t n; Value* f; Symbol x; } numeral_fn;
+        struct { bool value; Symbol a; Symbol b; } boolean;
+        struct { bool value; Symbol b; Value* a; } boolean_fn;
+        struct { const NativeOp* op; Value* args[2]; } delta; //unused slots are null
+    };
+};
+
+// Values that read back as a lambda, and the binder name they give it.
+inline bool value_is_lambda(const Value* v) {
+    switch (v->type) {
+        case ValueType::Closure:
+        case ValueType::Numeral:
+        case ValueType::NumeralFn:
+        case ValueType::Boolean:
+        case ValueType::BooleanFn:
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline Symbol value_hint(const Value* v) {
+    switch (v->type) {
+        case ValueType::Closure: return v->closure.hint;
+        case ValueType::Numeral: return v->numeral.f;
+        case ValueType::NumeralFn: return v->numeral_fn.x;
+        case ValueType::Boolean: return v->boolean.a;
+        case ValueType::BooleanFn: return v->boolean_fn.b;
+        default: return NO_SYMBOL;
+    }
+}
+
+// Environment frame: the value of the innermost binder and a link to the
+// frames outside it, which every environment extended from them shares, so
+// extending allocates one frame whatever the depth. Index i is found i links
+// up. The empty environment is a frame with no parent.
+//
+// This gives up the single array access per lookup that flat environments
+// have. Copying the captured slots on every extension cost more in time and
+// memory than the links it saves, since variables are mostly bound close by.
+// Where a closure's body is compiled ahead, as in the vm, flat capture of
+// only the variables it uses is the better choice (see bytecode.cpp).
+struct Env {
+    const Env* parent;
+    Value* value;
+
+    Value* lookup(uint32_t index) const {
+        const Env* e = this;
+        while (index--) e = e->parent;
+        return e->value;
+    }
+};
+
+inline Value* value_new(Arena* arena, ValueType type) {
+    Value* v = (Value*)arena->alloc(sizeof(Value));
+    v->type = type;
+#if LAMBDA_STATS
+    v->centre = stats_centre;
+#endif
+    return v;
+}
+
+// Delays evaluating `term` in `env` until the value is first needed. The first
+// force stores its result in the thunk, so every holder shares it. Variables and
+// lambdas are cheap to evaluate and are returned directly instead.
+inline Value* thunk_new(Arena* arena, const Term* term, const Env* env) {
+    if (term->type == TermType::Var) return env->lookup(term->index);
+    if (term->type == TermType::Lam) {
+        Value* v = value_new(arena, ValueType::Closure);
+        v->closure.hint = term->lam.hint;
+        v->closure.body = term->lam.body;
+        v->closure.env = env;
+        return v;
+    }
+    Value* v = value_new(arena, ValueType::Thunk);
+    v->thunk.term = term;
+    v->thunk.env = env;
+    v->thunk.result = nullptr;
+    return v;
+}
+
+//a thunk whose evaluation is in progress has neither a term nor a result
+inline bool thunk_is_forcing(const Value* v) {
+    return v->thunk.result == nullptr && v->thunk.term == nullptr;
+}
+
+inline const Env* env_empty(Arena* arena) {
+    Env* e = (Env*)arena->alloc(sizeof(Env));
+    e->parent = nullptr;
+    e->value = nullptr;
+    return e;
+}
+
+inline const Env* env_extend(Arena* arena, const Env* env, Value* v) {
+    Env* e = (Env*)arena->alloc(sizeof(Env));
+    e->parent = env;
+    e->value = v;
+    return e;
+}
+
+
+// Recursive evaluator behind normalize_term. Other backends reuse its eval and
+// apply when they only need to change how results are read back.
+struct Evaluator {
+    Arena* arena;
+    EvalContext& ctx;
+    const Env* empty;
+
+    Evaluator(Arena* arena, EvalContext& ctx) : arena(arena), ctx(ctx), empty(env_empty(arena)) {}
+
+    Value* eval(const Term* term, const Env* env);
+    Value* force(Value* v);
+    Value* apply(Value* fn, Value* arg);
+    Term* quote(Value* v, uint32_t depth);
+};
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "term.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// term_share_stress [threads] [rounds]
+//
+// Threads build and release the same small term in one shared factory, so
+// lookups in the table keep meeting nodes another thread is releasing. Needs
+// LAMBDA_ATOMIC_REFS; best run under a sanitizer.
+int main(int argc, char** argv) {
+    unsigned threads = argc > 1 ? (unsigned)atoi(argv[1]) : 8;
+    unsigned rounds = argc > 2 ? (unsigned)atoi(argv[2]) : 200000;
+
+    TermFactory factory;
+    Term* v;
+    {
+        TermScope scope(&factory);
+        v = term_var(0);
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([&] {
+            TermScope scope(&factory);
+            for (unsigned j = 0; j < rounds; j++) {
+                Term* t = term_lam(NO_SYMBOL, term_app(term_retain(v), term_retain(v)));
+                term_release(t);
+            }
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    TermScope scope(&factory);
+    size_t live = factory.stats().live_nodes;
+    term_release(v);
+    if (live != 1 || factory.stats().live_nodes != 0) {
+        fprintf(stderr, "FAILED: %zu nodes left alive, expected 1\n", live);
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file